@@ -0,0 +1,54 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Wakes threads waiting for functions in a view to finish analysis.
+// Every function update or removal in the view bumps a generation counter, and waiters recheck
+// their function when it changes. Waits also recheck periodically, in case an update was never reported.
+class AnalysisUpdateNotification
+    : public BinaryDataNotification
+{
+protected:
+    Ref<BinaryView> m_View;
+
+    uint64_t m_Generation = 0;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+
+    void Signal();
+
+public:
+    static constexpr std::chrono::milliseconds DefaultFallback {250};
+
+    AnalysisUpdateNotification(Ref<BinaryView> view);
+
+    virtual ~AnalysisUpdateNotification();
+
+    AnalysisUpdateNotification(const AnalysisUpdateNotification&) = delete;
+    AnalysisUpdateNotification& operator=(const AnalysisUpdateNotification&) = delete;
+
+    void OnAnalysisFunctionUpdated(BinaryView* view, Function* func) override;
+    void OnAnalysisFunctionRemoved(BinaryView* view, Function* func) override;
+
+    // Blocks until func no longer needs an update
+    void Wait(Function* func, std::chrono::milliseconds fallback = DefaultFallback);
+};
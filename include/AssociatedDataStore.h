@@ -0,0 +1,189 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+#include "EpochReclaimer.h"
+#include "ObjectDestructionNotification.h"
+
+#include <unordered_map>
+#include <memory>
+
+#include <atomic>
+#include <mutex>
+
+// Data associated with a core object, removed when the object is destroyed.
+// Keys are split across shards, each publishing an immutable snapshot of its map which Get reads without locking.
+// Writers copy and republish only their own shard, and replaced snapshots are freed once no reader can still see them.
+template <typename Key, typename T>
+class AssociatedDataStore
+    : protected ObjectDestructionNotification
+{
+protected:
+    using SessionDataMap = std::unordered_map<Key*, std::unique_ptr<T>>;
+    using SessionSnapshot = std::unordered_map<Key*, T*>;
+
+    static const size_t ShardBits = 4;
+
+    struct alignas(64) Shard
+    {
+        std::atomic<const SessionSnapshot*> Snapshot {nullptr};
+        SessionDataMap SessionData;
+        std::mutex Mutex;
+    };
+
+    Shard m_Shards[size_t(1) << ShardBits];
+
+    Shard& GetShard(Key* key)
+    {
+        const uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key)) * 0x9E3779B97F4A7C15ULL;
+
+        return m_Shards[hash >> (64 - ShardBits)];
+    }
+
+    // Requires shard.Mutex
+    void Publish(Shard& shard)
+    {
+        std::unique_ptr<SessionSnapshot> snapshot(new SessionSnapshot());
+
+        for (const auto& data : shard.SessionData)
+        {
+            snapshot->emplace(data.first, data.second.get());
+        }
+
+        const SessionSnapshot* previous = shard.Snapshot.exchange(snapshot.release(), std::memory_order_acq_rel);
+
+        if (previous)
+        {
+            EpochReclaimer::Retire(std::unique_ptr<const SessionSnapshot>(previous));
+        }
+    }
+
+    // The value is freed outside the lock. Callers must not use a value once its key is being destroyed.
+    void Destruct(Key* key)
+    {
+        Shard& shard = GetShard(key);
+
+        std::unique_ptr<T> value;
+
+        {
+            std::lock_guard<std::mutex> guard(shard.Mutex);
+
+            auto find = shard.SessionData.find(key);
+
+            if (find == shard.SessionData.end())
+            {
+                return;
+            }
+
+            value = std::move(find->second);
+
+            shard.SessionData.erase(find);
+
+            Publish(shard);
+        }
+    }
+
+public:
+    AssociatedDataStore() = default;
+    AssociatedDataStore(const AssociatedDataStore&) = delete;
+    AssociatedDataStore& operator=(const AssociatedDataStore&) = delete;
+
+    ~AssociatedDataStore()
+    {
+        for (Shard& shard : m_Shards)
+        {
+            delete shard.Snapshot.load(std::memory_order_relaxed);
+        }
+
+        EpochReclaimer::Collect();
+    }
+
+    T* Get(Key* key)
+    {
+        Shard& shard = GetShard(key);
+
+        EpochReclaimer::Guard guard;
+
+        const SessionSnapshot* snapshot = shard.Snapshot.load(std::memory_order_acquire);
+
+        if (snapshot == nullptr)
+        {
+            return nullptr;
+        }
+
+        auto find = snapshot->find(key);
+
+        if (find != snapshot->end())
+        {
+            return find->second;
+        }
+
+        return nullptr;
+    }
+
+    const T* Get(Key* key) const
+    {
+        return const_cast<AssociatedDataStore*>(this)->Get(key);
+    }
+
+    void Set(Key* key, std::unique_ptr<T> value)
+    {
+        Shard& shard = GetShard(key);
+
+        std::lock_guard<std::mutex> guard(shard.Mutex);
+
+        if (shard.SessionData.emplace(key, std::move(value)).second)
+        {
+            Publish(shard);
+        }
+    }
+
+    // Returns the existing value, or creates one. Concurrent callers for the same key run create exactly once.
+    // create runs under the shard lock, so must not use this store.
+    template <typename Func>
+    T* GetOrCreate(Key* key, Func&& create)
+    {
+        if (T* value = Get(key))
+        {
+            return value;
+        }
+
+        Shard& shard = GetShard(key);
+
+        std::lock_guard<std::mutex> guard(shard.Mutex);
+
+        auto find = shard.SessionData.find(key);
+
+        if (find != shard.SessionData.end())
+        {
+            return find->second.get();
+        }
+
+        std::unique_ptr<T> created = create();
+        T* value = created.get();
+
+        shard.SessionData.emplace(key, std::move(created));
+
+        Publish(shard);
+
+        return value;
+    }
+};
+
+// Measures Get and GetOrCreate throughput on 1 to N threads, against a single mutex guarded map
+void BenchmarkAssociatedDataStore();
@@ -16,10 +16,13 @@
 #pragma once
 
 #include "BinaryNinja.h"
+#include "DataBufferCodec.h"
 
 #include <bitsery/details/adapter_utils.h>
 
+#include <algorithm>
 #include <array>
+#include <future>
 
 class InputDataBufferAdapater
 {
@@ -60,3 +63,74 @@ public:
 
     size_t writtenBytesCount() const;
 };
+
+// Compresses in fixed size windows as it is written, one window compressing on a shared worker thread while the next fills.
+// Each frame is stored as [raw size : u32][compressed size : u32][compressed data].
+class OutputCompressedDataBufferAdapater
+{
+protected:
+    DataBuffer * buffer_;
+    const DataBufferCodec * codec_;
+    size_t window_size_;
+
+    DataBuffer windows_[2];
+    size_t current_window_;
+    size_t window_offset_;
+
+    DataBuffer frame_;
+    size_t frame_size_;
+    std::future<bool> pending_;
+
+    size_t current_size_;
+    bool error_;
+
+    void submit();
+    void wait();
+
+public:
+    using TValue = uint8_t;
+    using TIterator = TValue*;
+
+    static const size_t DefaultWindowSize = 0x40000;
+
+    OutputCompressedDataBufferAdapater(DataBuffer& buffer, const DataBufferCodec& codec, size_t window_size = DefaultWindowSize);
+    OutputCompressedDataBufferAdapater(OutputCompressedDataBufferAdapater&&) = default;
+    ~OutputCompressedDataBufferAdapater();
+
+    void write(const uint8_t *data, const size_t size);
+    void flush();
+
+    // Zero if any frame failed to compress
+    size_t writtenBytesCount() const;
+    bool isCompletedSuccessfully() const;
+};
+
+// Reads frames written by OutputCompressedDataBufferAdapater, decompressing one window at a time.
+// Frames are decompressed in place, so the compressed data is never copied.
+class InputCompressedDataBufferAdapater
+{
+protected:
+    const uint8_t * data_;
+    size_t size_;
+    const DataBufferCodec * codec_;
+    size_t offset_;
+
+    DataBuffer window_;
+    size_t window_offset_;
+
+    bitsery::ReaderError error_;
+
+    bool next_window();
+
+public:
+    using TValue = uint8_t;
+    using TIterator = TValue*;
+
+    InputCompressedDataBufferAdapater(const uint8_t* data, size_t size, const DataBufferCodec& codec);
+
+    void read(uint8_t* data, size_t size);
+    void setError(bitsery::ReaderError error);
+
+    bitsery::ReaderError error() const;
+    bool isCompletedSuccessfully() const;
+};
@@ -0,0 +1,44 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+// A compression scheme for patch blobs. Ids are stored alongside the data, so must never be reused.
+class DataBufferCodec
+{
+public:
+    enum : uint32_t
+    {
+        Zlib = 0,
+        Lz = 1,
+    };
+
+    virtual ~DataBufferCodec() = default;
+
+    virtual uint32_t GetId() const = 0;
+    virtual const char* GetName() const = 0;
+
+    virtual bool Compress(const DataBuffer& input, DataBuffer& output) const = 0;
+    // Reads the frame in place, so callers can decompress straight out of a larger buffer
+    virtual bool Decompress(const uint8_t* input, size_t input_size, size_t raw_size, DataBuffer& output) const = 0;
+
+    // Returns nullptr for unknown ids
+    static const DataBufferCodec* GetCodec(uint32_t id);
+    static const DataBufferCodec& GetDefaultCodec();
+
+    static std::vector<const DataBufferCodec*> GetCodecs();
+};
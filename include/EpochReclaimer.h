@@ -0,0 +1,50 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Epoch based reclamation for structures read without locks.
+// Readers pin the current epoch while they hold a pointer, and retired objects are only freed once
+// every thread that was pinned when they were retired has since unpinned.
+class EpochReclaimer
+{
+public:
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    static void Retire(std::function<void()> deleter);
+
+    template <typename T>
+    static void Retire(std::unique_ptr<T> value)
+    {
+        T* pointer = value.release();
+
+        Retire([pointer] { delete pointer; });
+    }
+
+    // Frees whatever is no longer reachable by any pinned reader
+    static void Collect();
+};
@@ -0,0 +1,30 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "AssociatedDataStore.h"
+
+// Shared by every view of a file, such as the raw view and the PE/ELF view loaded from it
+template <typename T>
+class FileAssociatedDataStore
+    : public AssociatedDataStore<BNFileMetadata, T>
+{
+protected:
+    void DestructFileMetadata(BNFileMetadata* file) override
+    {
+        this->Destruct(file);
+    }
+};
@@ -0,0 +1,184 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+#include "ObjectDestructionNotification.h"
+
+#include <unordered_map>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <mutex>
+
+// Results derived from a function's analysis, tagged with the IL they were derived from.
+// An entry is dropped once the function's IL changes, when the function is destroyed, or when
+// the least recently used entries are evicted to stay under the memory budget.
+// T must provide GetMemoryUsage(). Values are shared, so evicting one never invalidates a caller's copy.
+template <typename T>
+class FunctionAssociatedDataStore
+    : protected ObjectDestructionNotification
+{
+protected:
+    struct Entry
+    {
+        BNFunction* Function;
+        BNLowLevelILFunction* Generation;
+        std::shared_ptr<const T> Value;
+        size_t Size;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    // Most recently used first
+    EntryList m_Entries;
+    std::unordered_map<BNFunction*, typename EntryList::iterator> m_Index;
+    size_t m_Usage = 0;
+    size_t m_Budget;
+    mutable std::mutex m_Mutex;
+
+    // Requires m_Mutex. Values are returned rather than freed, so they're released outside the lock.
+    std::shared_ptr<const T> Remove(typename EntryList::iterator entry)
+    {
+        std::shared_ptr<const T> value = std::move(entry->Value);
+
+        m_Usage -= entry->Size;
+        m_Index.erase(entry->Function);
+        m_Entries.erase(entry);
+
+        return value;
+    }
+
+    // Requires m_Mutex
+    void Trim(std::vector<std::shared_ptr<const T>>& evicted)
+    {
+        while ((m_Usage > m_Budget) && !m_Entries.empty())
+        {
+            evicted.push_back(Remove(std::prev(m_Entries.end())));
+        }
+    }
+
+    void DestructFunction(BNFunction* func) override
+    {
+        Evict(func);
+    }
+
+public:
+    static const size_t DefaultBudget = 64 * 1024 * 1024;
+
+    FunctionAssociatedDataStore(size_t budget = DefaultBudget)
+        : m_Budget(budget)
+    { }
+
+    // Returns nullptr if nothing was cached for this generation of the function
+    std::shared_ptr<const T> Get(BNFunction* func, BNLowLevelILFunction* generation)
+    {
+        std::shared_ptr<const T> stale;
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        auto find = m_Index.find(func);
+
+        if (find == m_Index.end())
+        {
+            return nullptr;
+        }
+
+        if (find->second->Generation != generation)
+        {
+            stale = Remove(find->second);
+
+            return nullptr;
+        }
+
+        m_Entries.splice(m_Entries.begin(), m_Entries, find->second);
+
+        return find->second->Value;
+    }
+
+    // create runs without the lock held. If two threads race, the first value stored is kept.
+    template <typename Func>
+    std::shared_ptr<const T> GetOrCreate(BNFunction* func, BNLowLevelILFunction* generation, Func&& create)
+    {
+        if (std::shared_ptr<const T> value = Get(func, generation))
+        {
+            return value;
+        }
+
+        std::shared_ptr<const T> created = create();
+
+        std::vector<std::shared_ptr<const T>> evicted;
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        auto find = m_Index.find(func);
+
+        if (find != m_Index.end())
+        {
+            if (find->second->Generation == generation)
+            {
+                return find->second->Value;
+            }
+
+            evicted.push_back(Remove(find->second));
+        }
+
+        const size_t size = created->GetMemoryUsage();
+
+        m_Entries.push_front({ func, generation, created, size });
+        m_Index.emplace(func, m_Entries.begin());
+        m_Usage += size;
+
+        Trim(evicted);
+
+        return created;
+    }
+
+    void Evict(BNFunction* func)
+    {
+        std::shared_ptr<const T> evicted;
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        auto find = m_Index.find(func);
+
+        if (find != m_Index.end())
+        {
+            evicted = Remove(find->second);
+        }
+    }
+
+    void SetBudget(size_t budget)
+    {
+        std::vector<std::shared_ptr<const T>> evicted;
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        m_Budget = budget;
+
+        Trim(evicted);
+    }
+
+    size_t GetUsage() const
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        return m_Usage;
+    }
+};
@@ -0,0 +1,70 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Counters kept by the lifting hook. Each thread writes its own record without any atomic read-modify-writes,
+// and the records are only merged when someone asks for them.
+class HookStatistics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Bucket i counts samples of [2^i, 2^(i+1)) nanoseconds
+    static const size_t BucketCount = 40;
+
+    struct Snapshot
+    {
+        uint64_t Calls = 0;
+        uint64_t Hits = 0;
+        uint64_t Failures = 0;
+
+        // Hits on patches which didn't fit in their thread's table, so aren't in PatchHits
+        uint64_t UntrackedHits = 0;
+
+        uint64_t Lookup[BucketCount] {};
+        uint64_t Evaluate[BucketCount] {};
+
+        // Address -> times a patch there was used
+        std::vector<std::pair<uintptr_t, uint64_t>> PatchHits;
+    };
+
+    static void RecordLookup(uintptr_t address, bool hit);
+    static void RecordEvaluate(bool success);
+
+    // Reading the clock costs about as much as a lookup, so only 1 in TimingInterval calls on each thread is timed
+    static const uint32_t TimingInterval = 64;
+
+    static bool ShouldTime();
+
+    static void RecordLookupTime(Clock::duration elapsed);
+    static void RecordEvaluateTime(Clock::duration elapsed);
+
+    // Merges every thread's counters, less whatever was counted before the last Reset
+    static Snapshot Collect();
+
+    static void Reset();
+
+    // Logs the counters, the view's patches, and the top hottest patches
+    static void Log(BinaryView& view, size_t top = 20);
+};
@@ -0,0 +1,96 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "BinaryNinja.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PassState;
+
+struct PassResult
+{
+    // Blocks (or candidate sites) the pass looked at
+    size_t Visited;
+
+    // Patches the pass made
+    size_t Patches;
+};
+
+// A named step of deobfuscation. Each pass can be switched off through the obfu.passes.<name> setting,
+// and keeps running totals of how often it ran, how long it took and what it did.
+class ObfuPass
+{
+public:
+    enum class Stage
+    {
+        // Run every pass until the function stops changing
+        Fix,
+
+        // Run once, after the function has been fixed
+        Label,
+    };
+
+    using Callback = std::function<PassResult(BinaryView* view, Function* func, PassState& state)>;
+
+protected:
+    std::string m_Name;
+    std::string m_Title;
+    std::string m_Description;
+    Stage m_Stage;
+    int m_Order;
+    bool m_DefaultEnabled;
+    Callback m_Callback;
+
+    std::atomic<uint64_t> m_Runs {0};
+    std::atomic<uint64_t> m_Nanoseconds {0};
+    std::atomic<uint64_t> m_Visited {0};
+    std::atomic<uint64_t> m_Patches {0};
+
+public:
+    ObfuPass(std::string name, std::string title, std::string description, Stage stage, int order, bool enabled, Callback callback);
+
+    const std::string& GetName() const;
+    Stage GetStage() const;
+    int GetOrder() const;
+
+    std::string GetSettingName() const;
+    std::string GetSettingProperties() const;
+
+    bool IsEnabled(BinaryView* view) const;
+
+    PassResult Run(BinaryView* view, Function* func, PassState& state);
+
+    void LogStatistics() const;
+    void ResetStatistics();
+};
+
+class ObfuPassRegistry
+{
+public:
+    // Passes are never unregistered, so the returned pointer stays valid
+    static ObfuPass* Register(std::unique_ptr<ObfuPass> pass);
+
+    // The passes of a stage which are enabled for this view, in order
+    static std::vector<ObfuPass*> GetPasses(ObfuPass::Stage stage, BinaryView* view);
+
+    static void LogStatistics();
+    static void ResetStatistics();
+};
@@ -17,8 +17,20 @@
 
 #include "BinaryNinja.h"
 
+#include <vector>
+
+// Registers the built in passes, and their settings
+void RegisterObfuPasses();
+
 void FixObfuscation(
     Ref<BackgroundTask> task,
     Ref<BinaryView> view,
     Ref<Function> func,
     bool auto_save);
+
+// Deobfuscates the functions in rounds, with one analysis update per round, then saves the patches once
+void FixObfuscationBatch(
+    Ref<BackgroundTask> task,
+    Ref<BinaryView> view,
+    std::vector<Ref<Function>> funcs,
+    bool auto_save);
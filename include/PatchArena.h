@@ -0,0 +1,64 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "PatchBuilder.h"
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace PatchBuilder
+{
+    // Monotonic storage for a collection's patches and their parameters.
+    // Nothing is freed before the arena itself, as lifters may still be reading retired patches.
+    class PatchArena
+    {
+    protected:
+        static const size_t PatchesPerBlock = 1024;
+        static const size_t BytesPerBlock = 0x10000;
+
+        struct PatchBlock
+        {
+            size_t Count = 0;
+            typename std::aligned_storage<sizeof(Patch), alignof(Patch)>::type Patches[PatchesPerBlock];
+
+            ~PatchBlock();
+        };
+
+        std::vector<std::unique_ptr<PatchBlock>> m_PatchBlocks;
+        std::vector<std::unique_ptr<uint8_t[]>> m_ByteBlocks;
+
+        uint8_t* m_Bytes = nullptr;
+        size_t m_BytesLeft = 0;
+
+        size_t m_Reserved = 0;
+        size_t m_Used = 0;
+
+        uint8_t* AllocateBytes(size_t size, size_t align = 1);
+
+    public:
+        PatchArena() = default;
+        PatchArena(const PatchArena&) = delete;
+        PatchArena& operator=(const PatchArena&) = delete;
+
+        // Moves the patch into the arena, along with any parameters and values it owns
+        const Patch* Store(Patch patch);
+
+        size_t GetReserved() const;
+        size_t GetUsed() const;
+    };
+}
@@ -17,6 +17,7 @@
 
 #include "BinaryNinja.h"
 
+#include <memory>
 #include <vector>
 
 namespace PatchBuilder
@@ -40,24 +41,114 @@ namespace PatchBuilder
         }
     };
 
-    struct Patch
+    // Tokens are packed as varints: the first byte holds a continuation bit, the token type and the low 6 bits
+    // of the zigzag encoded value, followed by LEB128 groups. Small or small negative values take a single byte.
+    void EncodeToken(std::vector<uint8_t>& output, const Token& token);
+    bool DecodeToken(const uint8_t*& data, const uint8_t* end, Token& token);
+
+    // The shared body of a patch. Operands which aren't an instruction's count, flags or size are parameters,
+    // encoded here as zero and listed by token index in Slots.
+    struct PatchTemplate
     {
-        size_t Size;
+        static const size_t MaxCodeSize = 0x10000;
+
+        std::vector<uint8_t> Code;
+        std::vector<uint32_t> Slots;
+
+        // Code decoded by InternTemplate, so patches never decode varints while lifting
         std::vector<Token> Tokens;
 
+        // Set by InternTemplate if the tokens form whole instructions, so patches only need to check their parameters
+        bool Valid = false;
+
         template <typename S>
         void serialize(S& s)
         {
-            s.value8b(Size);
-            s.container(Tokens, 4096);
+            s.container1b(Code, MaxCodeSize);
+            s.container4b(Slots, MaxCodeSize);
         };
 
+        bool operator==(const PatchTemplate& other) const;
+    };
+
+    // Returns the pooled template equal to this one, adding it if needed
+    std::shared_ptr<const PatchTemplate> InternTemplate(PatchTemplate tmpl);
+
+    struct Patch
+    {
+        static const size_t MaxStackDepth = 128;
+        static const size_t MaxCodeSize = PatchTemplate::MaxCodeSize;
+
+        uint32_t Size = 0;
+        uint32_t ParamSize = 0;
+        bool Verified = false;
+        std::shared_ptr<const PatchTemplate> Template;
+
+        // Points into OwnedParams, or into the arena of the collection holding this patch
+        const uint8_t* Params = nullptr;
+        std::unique_ptr<uint8_t[]> OwnedParams;
+
+        // The decoded parameters, one per template slot. Filled in by Verify, and owned like Params.
+        const size_t* Values = nullptr;
+        std::unique_ptr<size_t[]> OwnedValues;
+
+        Patch() = default;
+        Patch(size_t size, const std::vector<Token>& tokens);
+        Patch(size_t size, std::shared_ptr<const PatchTemplate> tmpl, const uint8_t* params, size_t param_size);
+
+        std::vector<Token> GetTokens() const;
+
+        bool Verify();
         bool Evaluate(LowLevelILFunction& il) const;
     };
 
     void AddPatch(BinaryView& view, uintptr_t address, Patch patch);
+
+    // The patch stays valid while the caller holds an EpochReclaimer::Guard
     const Patch* GetPatch(LowLevelILFunction& il, uintptr_t address);
 
+    void PreloadPatches(BinaryView& view);
+
+    // Drops any queued loads and joins the loading threads. Called as the plugin is unloaded.
+    void ShutdownPatches();
     void LoadPatches(BinaryView& view);
     void SavePatches(BinaryView& view);
+
+    bool ExportPatches(BinaryView& view, const std::string& path);
+    bool ImportPatches(BinaryView& view, const std::string& path);
+
+    void BenchmarkCodecs(BinaryView& view);
+
+    // Logs the throughput of looking up and evaluating patches on 1 to N threads at once
+    void BenchmarkLifting(BinaryView& view);
+
+    struct PatchTotals
+    {
+        size_t Count = 0;
+
+        // Encoded size of every patch's tokens, as if none of their templates were shared
+        size_t TokenBytes = 0;
+        size_t ParamBytes = 0;
+
+        void Add(const Patch& patch);
+        void Add(const PatchTotals& totals);
+    };
+
+    struct PatchStatistics
+    {
+        PatchTotals Loaded;
+
+        // Distinct templates used by the loaded patches
+        size_t Templates = 0;
+
+        // Saved chunks which haven't been decoded yet, from the totals recorded when they were saved
+        size_t UnloadedChunks = 0;
+        PatchTotals Unloaded;
+
+        // Imported records which haven't been looked up yet
+        size_t UnloadedImports = 0;
+    };
+
+    // Doesn't decode anything, so is cheap enough to call while analysis is running
+    PatchStatistics GetPatchStatistics(BinaryView& view);
 }
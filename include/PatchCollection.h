@@ -0,0 +1,177 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "PatchArena.h"
+#include "PatchBuilder.h"
+#include "PatchTable.h"
+#include "WorkStealingPool.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <set>
+#include <memory>
+#include <vector>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+
+namespace PatchBuilder
+{
+    using PatchMap = std::unordered_map<uintptr_t, Patch>;
+
+    struct PatchEntryRef
+    {
+        uintptr_t Address;
+        const Patch* Value;
+
+        bool operator<(const PatchEntryRef& other) const
+        {
+            return Address < other.Address;
+        }
+    };
+
+    using PatchRefs = std::vector<PatchEntryRef>;
+
+    class PatchDatabase;
+
+    class PatchCollection
+    {
+    protected:
+        // A range of the saved base which hasn't been decoded yet
+        struct Chunk
+        {
+            uintptr_t Start;
+            Ref<Metadata> Data;
+            PatchTotals Totals;
+            std::atomic<bool> Pending;
+        };
+
+        struct ChunkIndex
+        {
+            size_t Count = 0;
+            std::unique_ptr<Chunk[]> Chunks;
+            std::atomic<size_t> Pending {0};
+        };
+
+        // An imported database, whose records are only decoded and verified when first used.
+        // Templates and Loaded are guarded by m_Mutex. Patches use their parameters in place, so it stays mapped.
+        struct ImportedDatabase
+        {
+            std::shared_ptr<const PatchDatabase> Database;
+            std::vector<std::shared_ptr<const PatchTemplate>> Templates;
+            std::vector<bool> Loaded;
+            size_t Remaining = 0;
+            std::atomic<bool> Pending {true};
+        };
+
+        struct ImportIndex
+        {
+            std::vector<std::shared_ptr<ImportedDatabase>> Databases;
+        };
+
+        // Lifters only ever touch m_Table, m_ChunkIndex and m_Imports, everything else is guarded by m_Mutex.
+        // Replaced tables, indices and arenas are handed to the EpochReclaimer, as lifters may still be reading them.
+        std::atomic<PatchTable*> m_Table {nullptr};
+        std::unique_ptr<PatchArena> m_Storage {new PatchArena()};
+        std::vector<uintptr_t> m_Dirty;
+        mutable std::mutex m_Mutex;
+
+        // Every live patch by address, for iteration and range queries. Inserts are appended and merged in on demand.
+        mutable PatchRefs m_Index;
+        mutable size_t m_IndexSorted = 0;
+
+        // Running totals of the patches in m_Table, so statistics never need to walk them
+        PatchTotals m_Totals;
+        std::unordered_set<const PatchTemplate*> m_Templates;
+
+        std::atomic<ChunkIndex*> m_ChunkIndex {nullptr};
+        std::mutex m_ChunkMutex;
+
+        // Earlier imports take priority. Replaced as a whole on every Import or Load.
+        std::atomic<ImportIndex*> m_Imports {nullptr};
+
+        // Saves append the dirty patches to a journal, which is periodically compacted back into the base.
+        // Guarded by m_SaveMutex, so saving never blocks AddPatch for longer than it takes to snapshot.
+        std::map<uintptr_t, PatchTotals> m_BaseChunks;
+        std::vector<uintptr_t> m_Journaled;
+        size_t m_BaseCount = 0;
+        size_t m_JournalSegments = 0;
+        bool m_Compact = false;
+        std::mutex m_SaveMutex;
+
+        std::atomic<bool> m_Loaded {false};
+        std::shared_future<void> m_LoadFuture;
+
+        PatchTable* Publish(size_t capacity, const PatchTable* source);
+        bool InsertPatch(uintptr_t address, Patch patch);
+        void StorePatch(uintptr_t address, Patch patch, PatchTable& table);
+        void SortIndex() const;
+
+        void LoadChunk(ChunkIndex& chunks, uintptr_t address);
+        void LoadChunks(uintptr_t start, uintptr_t end);
+        void LoadAllChunks();
+
+        // Saved patches take priority over imported ones, so the chunks covering a record must be loaded before it is.
+        // LoadImport leaves that to its callers, the range loads do it themselves.
+        void LoadRecord(ImportedDatabase& imported, size_t index);
+        bool LoadImport(uintptr_t address);
+        void LoadImports(uintptr_t start, uintptr_t end);
+        void LoadAllImports();
+
+        PatchRefs GetPatches(const std::set<uintptr_t>& chunks) const;
+        bool StoreBase(BinaryView& view, const std::vector<uintptr_t>& dirty, bool full);
+
+    public:
+        PatchCollection() = default;
+        PatchCollection(const PatchCollection&) = delete;
+        PatchCollection& operator=(const PatchCollection&) = delete;
+
+        ~PatchCollection();
+
+        static const size_t MaxJournalSegments = 32;
+        static const uintptr_t ChunkSpan = 0x10000;
+
+        static uintptr_t GetChunkStart(uintptr_t address);
+
+        void AddPatch(uintptr_t address, Patch patch);
+
+        // The patch may be retired by a later Load, so callers using it must hold an EpochReclaimer::Guard
+        const Patch* GetPatch(uintptr_t address);
+
+        // All patches in [start, end), sorted by address. The caller must hold an EpochReclaimer::Guard while using them.
+        PatchRefs GetPatches(uintptr_t start, uintptr_t end);
+
+        void Save(BinaryView& view);
+        void Load(BinaryView& view);
+
+        PatchStatistics GetStatistics();
+
+        bool Export(const std::string& path);
+        // Only queues the database, its records are decoded as they are looked up or saved
+        void Import(std::shared_ptr<const PatchDatabase> database);
+
+        // Logs the memory used by the current patches, lookup latency, serialization speed, and the ratio and
+        // throughput of each codec on them
+        void BenchmarkCodecs();
+
+        // Queues the initial load on the pool. Must be called before the collection is shared.
+        void LoadAsync(WorkStealingPool& pool, Ref<BinaryView> view);
+        void WaitForLoad();
+    };
+}
@@ -0,0 +1,108 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "PatchBuilder.h"
+#include "PatchCollection.h"
+
+#include <memory>
+#include <string>
+
+namespace PatchBuilder
+{
+    // A read-only, memory mapped patch file. Every section is page aligned and used in place,
+    // so opening one only validates the layout rather than deserializing anything.
+    // Files are only readable on hosts with the same byte order as the one that wrote them.
+    // Records are sorted by address, and refer to templates and parameter bytes in the data section.
+    class PatchDatabase
+    {
+    public:
+        static const uint32_t Version = 2;
+        static const uint32_t PageSize = 0x1000;
+
+        // Written in native order, so a file from a host with a different byte order reads back swapped
+        static const uint32_t ByteOrder = 0x01020304;
+
+        struct Header
+        {
+            char Magic[8];
+            uint32_t ByteOrder;
+            uint32_t Version;
+            uint32_t PageSize;
+            uint32_t Reserved;
+            uint64_t PatchCount;
+            uint64_t TemplateCount;
+            uint64_t RecordsOffset;
+            uint64_t TemplatesOffset;
+            uint64_t DataOffset;
+            uint64_t DataSize;
+        };
+
+        struct Record
+        {
+            uint64_t Address;
+            uint32_t Size;
+            uint32_t Template;
+            uint64_t ParamOffset;
+            uint32_t ParamSize;
+            uint32_t Reserved;
+        };
+
+        struct TemplateRecord
+        {
+            uint64_t CodeOffset;
+            uint64_t SlotOffset;
+            uint32_t CodeSize;
+            uint32_t SlotCount;
+        };
+
+    protected:
+        const uint8_t* m_Data = nullptr;
+        size_t m_Size = 0;
+
+#ifdef _WIN32
+        void* m_Mapping = nullptr;
+#endif
+
+        const Header* m_Header = nullptr;
+        const Record* m_Records = nullptr;
+        const TemplateRecord* m_Templates = nullptr;
+
+        PatchDatabase() = default;
+
+        bool Validate() const;
+
+    public:
+        PatchDatabase(const PatchDatabase&) = delete;
+        PatchDatabase& operator=(const PatchDatabase&) = delete;
+        ~PatchDatabase();
+
+        static std::shared_ptr<const PatchDatabase> Open(const std::string& path);
+        static bool Write(const std::string& path, const PatchRefs& patches);
+
+        size_t GetPatchCount() const;
+        size_t GetTemplateCount() const;
+
+        const Record& GetRecord(size_t index) const;
+        const Record* Find(uintptr_t address) const;
+
+        // Index of the first record at or after the address
+        size_t LowerBound(uintptr_t address) const;
+
+        PatchTemplate GetTemplate(size_t index) const;
+        const uint8_t* GetData(uint64_t offset) const;
+    };
+}
@@ -0,0 +1,74 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "PatchBuilder.h"
+
+#include <atomic>
+#include <memory>
+
+namespace PatchBuilder
+{
+    // Insert-only open addressing table, safe to read while a single writer inserts.
+    // Slots are never moved or removed, so a full table is replaced rather than resized.
+    // A blocked bloom filter (one word, two bits per address) rejects most unpatched addresses before probing.
+    class PatchTable
+    {
+    protected:
+        struct Slot
+        {
+            std::atomic<uintptr_t> Address;
+            std::atomic<const Patch*> Value;
+        };
+
+        size_t m_Mask;
+        std::atomic<size_t> m_Size;
+        std::unique_ptr<Slot[]> m_Slots;
+
+        size_t m_FilterMask;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_Filter;
+
+        static uint64_t Hash(uintptr_t address);
+        static uint64_t FilterBits(uint64_t hash);
+
+    public:
+        PatchTable(size_t capacity);
+
+        const Patch* Find(uintptr_t address) const;
+
+        bool Insert(uintptr_t address, const Patch* patch);
+
+        bool IsFull() const;
+
+        size_t GetSize() const;
+        size_t GetCapacity() const;
+
+        // Bytes allocated for the slots and the filter
+        size_t GetMemoryUsage() const;
+
+        template <typename Func>
+        void ForEach(Func&& func) const
+        {
+            for (size_t i = 0; i <= m_Mask; ++i)
+            {
+                if (const Patch* patch = m_Slots[i].Value.load(std::memory_order_acquire))
+                {
+                    func(m_Slots[i].Address.load(std::memory_order_relaxed), *patch);
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,93 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Records spans as Chrome trace events, which can be opened in chrome://tracing or Perfetto.
+// While no trace is running, a span costs one relaxed atomic load.
+class TraceRecorder
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Non-zero while a trace is running, and different for every trace
+    static std::atomic<uint64_t> Session;
+
+    static void Start();
+
+    // Writes the trace to path, and stops recording
+    static bool Stop(const std::string& path);
+
+    static bool IsRecording()
+    {
+        return Session.load(std::memory_order_relaxed) != 0;
+    }
+
+    static void Record(uint64_t session, const char* category, const char* name,
+        Clock::time_point start, Clock::time_point end, std::vector<std::pair<const char*, std::string>> args);
+};
+
+class TraceSpan
+{
+protected:
+    uint64_t m_Session;
+    const char* m_Category;
+    const char* m_Name;
+    TraceRecorder::Clock::time_point m_Start;
+    std::vector<std::pair<const char*, std::string>> m_Args;
+
+public:
+    // category and name must outlive the trace
+    TraceSpan(const char* category, const char* name)
+        : m_Session(TraceRecorder::Session.load(std::memory_order_relaxed))
+        , m_Category(category)
+        , m_Name(name)
+    {
+        if (m_Session)
+        {
+            m_Start = TraceRecorder::Clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_Session)
+        {
+            TraceRecorder::Record(m_Session, m_Category, m_Name, m_Start, TraceRecorder::Clock::now(), std::move(m_Args));
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool IsRecording() const
+    {
+        return m_Session != 0;
+    }
+
+    void SetArg(const char* key, std::string value)
+    {
+        if (m_Session)
+        {
+            m_Args.emplace_back(key, std::move(value));
+        }
+    }
+};
@@ -0,0 +1,76 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of workers, each with its own queue.
+// Workers take the newest job from their own queue, and steal the oldest from another queue once theirs is empty.
+// Jobs submitted from a worker go to that worker's queue, everything else is dealt out round robin.
+class WorkStealingPool
+{
+public:
+    using Job = std::function<void()>;
+
+protected:
+    struct alignas(64) Queue
+    {
+        std::deque<Job> Jobs;
+        std::mutex Mutex;
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_Queues;
+    std::vector<std::thread> m_Threads;
+
+    // Guards the counters below
+    std::mutex m_Mutex;
+    std::condition_variable m_JobQueued;
+    std::condition_variable m_Idle;
+    size_t m_Queued = 0;
+    size_t m_Pending = 0;
+    size_t m_NextQueue = 0;
+    bool m_Stopping = false;
+
+    bool Pop(size_t index, Job& job);
+    void WorkerMain(size_t index);
+
+public:
+    static size_t GetDefaultThreadCount();
+
+    WorkStealingPool(size_t threads = GetDefaultThreadCount());
+
+    // Finishes every job already submitted
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t GetThreadCount() const;
+
+    void Submit(Job job);
+
+    // Drops every job which hasn't started yet. Jobs already running are left to finish.
+    void Cancel();
+
+    // Blocks until every submitted job has finished
+    void Wait();
+};
@@ -0,0 +1,78 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "AnalysisUpdateNotification.h"
+
+AnalysisUpdateNotification::AnalysisUpdateNotification(Ref<BinaryView> view)
+    : m_View(view)
+{
+    m_View->RegisterNotification(this);
+}
+
+AnalysisUpdateNotification::~AnalysisUpdateNotification()
+{
+    m_View->UnregisterNotification(this);
+}
+
+void AnalysisUpdateNotification::Signal()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        ++m_Generation;
+    }
+
+    m_Condition.notify_all();
+}
+
+void AnalysisUpdateNotification::OnAnalysisFunctionUpdated(BinaryView* view, Function* func)
+{
+    (void)view;
+    (void)func;
+
+    Signal();
+}
+
+void AnalysisUpdateNotification::OnAnalysisFunctionRemoved(BinaryView* view, Function* func)
+{
+    (void)view;
+    (void)func;
+
+    Signal();
+}
+
+void AnalysisUpdateNotification::Wait(Function* func, std::chrono::milliseconds fallback)
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    while (true)
+    {
+        // Read the generation before checking the function, so an update landing in between isn't missed
+        const uint64_t generation = m_Generation;
+
+        lock.unlock();
+
+        const bool pending = func->NeedsUpdate();
+
+        lock.lock();
+
+        if (!pending)
+        {
+            break;
+        }
+
+        m_Condition.wait_for(lock, fallback, [&] { return m_Generation != generation; });
+    }
+}
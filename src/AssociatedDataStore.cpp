@@ -0,0 +1,136 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "AssociatedDataStore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Keys are addresses within a local array, so they can never collide with a real function being destroyed
+struct BenchmarkKey
+{
+    char Padding[64];
+};
+
+// The store's design before sharding, for comparison
+class MutexDataStore
+{
+    std::unordered_map<BenchmarkKey*, std::unique_ptr<size_t>> m_Data;
+    std::mutex m_Mutex;
+
+public:
+    template <typename Func>
+    size_t* GetOrCreate(BenchmarkKey* key, Func&& create)
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        std::unique_ptr<size_t>& value = m_Data[key];
+
+        if (!value)
+        {
+            value = create();
+        }
+
+        return value.get();
+    }
+};
+
+// The sharded store is keyed on BNFunction, which the benchmark keys only stand in for
+struct ShardedDataStore
+{
+    AssociatedDataStore<BNFunction, size_t>& Store;
+
+    template <typename Func>
+    size_t* GetOrCreate(BenchmarkKey* key, Func&& create)
+    {
+        return Store.GetOrCreate(reinterpret_cast<BNFunction*>(key), create);
+    }
+};
+
+template <typename Store>
+static double RunStoreBenchmark(Store& store, std::vector<BenchmarkKey>& keys, size_t thread_count, size_t lookups)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::thread> threads;
+
+    clock::time_point start = clock::now();
+
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back([&store, &keys, lookups, i]
+        {
+            std::minstd_rand random(static_cast<uint32_t>(i + 1));
+
+            size_t sum = 0;
+
+            // Every key is created by whichever thread first asks for it, then only ever read
+            for (size_t j = 0; j < lookups; ++j)
+            {
+                BenchmarkKey* key = &keys[random() % keys.size()];
+
+                sum += *store.GetOrCreate(key, [key]
+                {
+                    return std::unique_ptr<size_t>(new size_t(reinterpret_cast<uintptr_t>(key)));
+                });
+            }
+
+            volatile size_t result = sum;
+            (void)result;
+        });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+void BenchmarkAssociatedDataStore()
+{
+    static const size_t KeyCount = 0x1000;
+    static const size_t Lookups = 0x100000;
+
+    const size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    BinjaLog(InfoLog, "Benchmarking {0} lookups per thread over {1} keys on 1 to {2} threads", Lookups, KeyCount, max_threads);
+
+    for (size_t thread_count = 1;; thread_count = std::min(thread_count * 2, max_threads))
+    {
+        std::vector<BenchmarkKey> keys(KeyCount);
+
+        AssociatedDataStore<BNFunction, size_t> sharded;
+        MutexDataStore locked;
+        ShardedDataStore sharded_store { sharded };
+
+        const double sharded_elapsed = RunStoreBenchmark(sharded_store, keys, thread_count, Lookups);
+        const double locked_elapsed = RunStoreBenchmark(locked, keys, thread_count, Lookups);
+
+        const double lookups = static_cast<double>(Lookups * thread_count);
+
+        BinjaLog(InfoLog, "{0} threads: sharded {1:.2f}M lookups/s, single mutex {2:.2f}M lookups/s ({3:.1f}x)",
+            thread_count, lookups / sharded_elapsed / 1e6, lookups / locked_elapsed / 1e6, locked_elapsed / sharded_elapsed);
+
+        if (thread_count == max_threads)
+        {
+            break;
+        }
+    }
+}
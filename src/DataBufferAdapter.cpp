@@ -14,6 +14,37 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "DataBufferAdapter.h"
+#include "WorkStealingPool.h"
+
+static const size_t FrameHeaderSize = 8;
+
+static void StoreFrameSize(uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        data[i] = static_cast<uint8_t>(size >> (i * 8));
+    }
+}
+
+// Windows from every adapter are compressed in order on one thread, rather than each starting its own
+static WorkStealingPool& GetCompressionPool()
+{
+    static WorkStealingPool pool(1);
+
+    return pool;
+}
+
+static size_t LoadFrameSize(const uint8_t* data)
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        size |= static_cast<size_t>(data[i]) << (i * 8);
+    }
+
+    return size;
+}
 
 InputDataBufferAdapater::InputDataBufferAdapater(DataBuffer& buffer)
     : buffer_(std::addressof(buffer))
@@ -95,3 +126,217 @@ size_t OutputDataBufferAdapater::writtenBytesCount() const
 {
     return current_size_;
 }
+
+OutputCompressedDataBufferAdapater::OutputCompressedDataBufferAdapater(DataBuffer& buffer, const DataBufferCodec& codec, size_t window_size)
+    : buffer_(std::addressof(buffer))
+    , codec_(std::addressof(codec))
+    , window_size_(window_size)
+    , current_window_(0)
+    , window_offset_(0)
+    , frame_size_(0)
+    , current_size_(0)
+    , error_(false)
+{ }
+
+OutputCompressedDataBufferAdapater::~OutputCompressedDataBufferAdapater()
+{
+    wait();
+}
+
+void OutputCompressedDataBufferAdapater::submit()
+{
+    wait();
+
+    DataBuffer& window = windows_[current_window_];
+
+    window.SetSize(window_offset_);
+    frame_size_ = window_offset_;
+
+    std::shared_ptr<std::promise<bool>> compressed(new std::promise<bool>());
+
+    pending_ = compressed->get_future();
+
+    GetCompressionPool().Submit([this, &window, compressed]
+    {
+        bool success = false;
+
+        try
+        {
+            success = codec_->Compress(window, frame_);
+        }
+        catch (const std::exception& e)
+        {
+            BinjaLog(ErrorLog, "Failed to compress window: {0}", e.what());
+        }
+
+        compressed->set_value(success);
+    });
+
+    current_window_ ^= 1;
+    window_offset_ = 0;
+}
+
+void OutputCompressedDataBufferAdapater::wait()
+{
+    if (!pending_.valid())
+    {
+        return;
+    }
+
+    if (pending_.get() && !error_)
+    {
+        uint8_t header[FrameHeaderSize];
+
+        StoreFrameSize(header, frame_size_);
+        StoreFrameSize(header + 4, frame_.GetLength());
+
+        buffer_->Append(header, FrameHeaderSize);
+        buffer_->Append(frame_);
+    }
+    else
+    {
+        error_ = true;
+    }
+
+    frame_.Clear();
+}
+
+void OutputCompressedDataBufferAdapater::write(const uint8_t *data, const size_t size)
+{
+    size_t remaining = size;
+
+    while (remaining)
+    {
+        DataBuffer& window = windows_[current_window_];
+
+        if (window.GetLength() != window_size_)
+        {
+            window.SetSize(window_size_);
+        }
+
+        const size_t count = std::min(remaining, window_size_ - window_offset_);
+
+        std::memcpy(window.GetDataAt(window_offset_), data, count);
+
+        data += count;
+        remaining -= count;
+        window_offset_ += count;
+
+        if (window_offset_ == window_size_)
+        {
+            submit();
+        }
+    }
+
+    current_size_ += size;
+}
+
+void OutputCompressedDataBufferAdapater::flush()
+{
+    if (window_offset_)
+    {
+        submit();
+    }
+
+    wait();
+
+    windows_[0].Clear();
+    windows_[1].Clear();
+}
+
+size_t OutputCompressedDataBufferAdapater::writtenBytesCount() const
+{
+    return error_ ? 0 : current_size_;
+}
+
+bool OutputCompressedDataBufferAdapater::isCompletedSuccessfully() const
+{
+    return !error_ && !window_offset_ && !pending_.valid();
+}
+
+InputCompressedDataBufferAdapater::InputCompressedDataBufferAdapater(const uint8_t* data, size_t size, const DataBufferCodec& codec)
+    : data_(data)
+    , size_(size)
+    , codec_(std::addressof(codec))
+    , offset_(0)
+    , window_offset_(0)
+    , error_(bitsery::ReaderError::NoError)
+{ }
+
+bool InputCompressedDataBufferAdapater::next_window()
+{
+    window_.Clear();
+    window_offset_ = 0;
+
+    if ((offset_ + FrameHeaderSize) > size_)
+    {
+        return false;
+    }
+
+    const uint8_t* header = data_ + offset_;
+
+    const size_t raw_size = LoadFrameSize(header);
+    const size_t frame_size = LoadFrameSize(header + 4);
+
+    if ((offset_ + FrameHeaderSize + frame_size) > size_)
+    {
+        return false;
+    }
+
+    if (!codec_->Decompress(header + FrameHeaderSize, frame_size, raw_size, window_))
+    {
+        window_.Clear();
+
+        return false;
+    }
+
+    offset_ += FrameHeaderSize + frame_size;
+
+    return true;
+}
+
+void InputCompressedDataBufferAdapater::read(uint8_t* data, size_t size)
+{
+    while (size && (error_ == bitsery::ReaderError::NoError))
+    {
+        if (window_offset_ == window_.GetLength())
+        {
+            if (!next_window())
+            {
+                setError(bitsery::ReaderError::DataOverflow);
+
+                break;
+            }
+
+            continue;
+        }
+
+        const size_t count = std::min(size, window_.GetLength() - window_offset_);
+
+        std::memcpy(data, window_.GetDataAt(window_offset_), count);
+
+        data += count;
+        size -= count;
+        window_offset_ += count;
+    }
+
+    if (size)
+    {
+        std::memset(data, 0, size);
+    }
+}
+
+void InputCompressedDataBufferAdapater::setError(bitsery::ReaderError error)
+{
+    error_ = error;
+}
+
+bitsery::ReaderError InputCompressedDataBufferAdapater::error() const
+{
+    return error_;
+}
+
+bool InputCompressedDataBufferAdapater::isCompletedSuccessfully() const
+{
+    return (error_ == bitsery::ReaderError::NoError) && (window_offset_ == window_.GetLength()) && (offset_ == size_);
+}
@@ -0,0 +1,292 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "DataBufferCodec.h"
+
+#include <cstring>
+
+class ZlibDataBufferCodec
+    : public DataBufferCodec
+{
+public:
+    uint32_t GetId() const override
+    {
+        return Zlib;
+    }
+
+    const char* GetName() const override
+    {
+        return "zlib";
+    }
+
+    bool Compress(const DataBuffer& input, DataBuffer& output) const override
+    {
+        return input.ZlibCompress(output);
+    }
+
+    bool Decompress(const uint8_t* input, size_t input_size, size_t raw_size, DataBuffer& output) const override
+    {
+        // The core only inflates from a DataBuffer, so this codec still copies the frame
+        DataBuffer frame(input, input_size);
+
+        return frame.ZlibDecompress(output) && (output.GetLength() == raw_size);
+    }
+};
+
+// Byte oriented LZ77, in the style of LZ4 blocks. Each sequence is a token (literal length : 4, match length - 4 : 4),
+// any extra literal length bytes, the literals, then a 2 byte offset and any extra match length bytes.
+// Lengths of 15 continue in following bytes, each adding up to 255. The final sequence has literals only.
+class LzDataBufferCodec
+    : public DataBufferCodec
+{
+protected:
+    static const size_t MinMatch = 4;
+    static const size_t MaxOffset = 0xFFFF;
+    static const size_t HashBits = 14;
+
+    // Matches can't start in the last few bytes, which keeps the final sequence literal only
+    static const size_t EndLiterals = 12;
+
+    static uint32_t Load32(const uint8_t* data)
+    {
+        uint32_t value;
+
+        std::memcpy(&value, data, sizeof(value));
+
+        return value;
+    }
+
+    static size_t Hash(uint32_t value)
+    {
+        return (value * 2654435761U) >> (32 - HashBits);
+    }
+
+    static void WriteLength(std::vector<uint8_t>& output, size_t length)
+    {
+        while (length >= 255)
+        {
+            output.push_back(255);
+            length -= 255;
+        }
+
+        output.push_back(static_cast<uint8_t>(length));
+    }
+
+    static bool ReadLength(const uint8_t*& data, const uint8_t* end, size_t& length)
+    {
+        uint8_t byte;
+
+        do
+        {
+            if (data == end)
+            {
+                return false;
+            }
+
+            byte = *data++;
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    }
+
+public:
+    uint32_t GetId() const override
+    {
+        return Lz;
+    }
+
+    const char* GetName() const override
+    {
+        return "lz";
+    }
+
+    bool Compress(const DataBuffer& input, DataBuffer& output) const override
+    {
+        const uint8_t* const begin = static_cast<const uint8_t*>(input.GetData());
+        const size_t size = input.GetLength();
+        const uint8_t* const end = begin + size;
+
+        std::vector<uint8_t> result;
+        result.reserve(size + (size / 255) + 16);
+
+        std::vector<uint32_t> table(size_t(1) << HashBits, 0);
+
+        const uint8_t* literals = begin;
+        const uint8_t* data = begin;
+
+        const uint8_t* const limit = (size > EndLiterals) ? (end - EndLiterals) : begin;
+
+        auto emit = [&] (size_t match_length, size_t offset)
+        {
+            const size_t literal_length = static_cast<size_t>(data - literals);
+
+            const size_t literal_token = std::min<size_t>(literal_length, 15);
+            const size_t match_token = match_length ? std::min<size_t>(match_length - MinMatch, 15) : 0;
+
+            result.push_back(static_cast<uint8_t>((literal_token << 4) | match_token));
+
+            if (literal_token == 15)
+            {
+                WriteLength(result, literal_length - 15);
+            }
+
+            result.insert(result.end(), literals, data);
+
+            if (match_length)
+            {
+                result.push_back(static_cast<uint8_t>(offset));
+                result.push_back(static_cast<uint8_t>(offset >> 8));
+
+                if (match_token == 15)
+                {
+                    WriteLength(result, match_length - MinMatch - 15);
+                }
+            }
+        };
+
+        while (data < limit)
+        {
+            const uint32_t value = Load32(data);
+            uint32_t& slot = table[Hash(value)];
+
+            const uint8_t* candidate = begin + slot;
+            slot = static_cast<uint32_t>(data - begin);
+
+            if ((candidate >= data) || (static_cast<size_t>(data - candidate) > MaxOffset) || (Load32(candidate) != value))
+            {
+                ++data;
+
+                continue;
+            }
+
+            size_t match_length = MinMatch;
+
+            while ((data + match_length < limit) && (candidate[match_length] == data[match_length]))
+            {
+                ++match_length;
+            }
+
+            emit(match_length, static_cast<size_t>(data - candidate));
+
+            data += match_length;
+            literals = data;
+        }
+
+        data = end;
+
+        emit(0, 0);
+
+        output.Clear();
+        output.Append(result.data(), result.size());
+
+        return true;
+    }
+
+    bool Decompress(const uint8_t* input, size_t input_size, size_t raw_size, DataBuffer& output) const override
+    {
+        const uint8_t* data = input;
+        const uint8_t* const end = data + input_size;
+
+        output.SetSize(raw_size);
+
+        uint8_t* const begin = static_cast<uint8_t*>(output.GetData());
+        uint8_t* const out_end = begin + raw_size;
+        uint8_t* out = begin;
+
+        while (data != end)
+        {
+            const uint8_t token = *data++;
+
+            size_t literal_length = token >> 4;
+
+            if ((literal_length == 15) && !ReadLength(data, end, literal_length))
+            {
+                return false;
+            }
+
+            if ((literal_length > static_cast<size_t>(end - data)) || (literal_length > static_cast<size_t>(out_end - out)))
+            {
+                return false;
+            }
+
+            std::memcpy(out, data, literal_length);
+
+            data += literal_length;
+            out += literal_length;
+
+            if (data == end)
+            {
+                break;
+            }
+
+            if ((end - data) < 2)
+            {
+                return false;
+            }
+
+            const size_t offset = data[0] | (static_cast<size_t>(data[1]) << 8);
+            data += 2;
+
+            size_t match_length = (token & 0xF) + MinMatch;
+
+            if (((token & 0xF) == 15) && !ReadLength(data, end, match_length))
+            {
+                return false;
+            }
+
+            if ((offset == 0) || (offset > static_cast<size_t>(out - begin)) || (match_length > static_cast<size_t>(out_end - out)))
+            {
+                return false;
+            }
+
+            // Matches may overlap their own output, so copy forwards byte by byte
+            const uint8_t* match = out - offset;
+
+            for (size_t i = 0; i < match_length; ++i)
+            {
+                out[i] = match[i];
+            }
+
+            out += match_length;
+        }
+
+        return out == out_end;
+    }
+};
+
+static const ZlibDataBufferCodec ZlibCodec;
+static const LzDataBufferCodec LzCodec;
+
+const DataBufferCodec* DataBufferCodec::GetCodec(uint32_t id)
+{
+    switch (id)
+    {
+        case Zlib: return &ZlibCodec;
+        case Lz: return &LzCodec;
+    }
+
+    return nullptr;
+}
+
+const DataBufferCodec& DataBufferCodec::GetDefaultCodec()
+{
+    return LzCodec;
+}
+
+std::vector<const DataBufferCodec*> DataBufferCodec::GetCodecs()
+{
+    return { &ZlibCodec, &LzCodec };
+}
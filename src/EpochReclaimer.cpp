@@ -0,0 +1,154 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "EpochReclaimer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct alignas(64) ThreadRecord
+    {
+        std::atomic<uint64_t> Epoch {0};
+        std::atomic<bool> InUse {false};
+        ThreadRecord* Next = nullptr;
+    };
+
+    struct RetiredObject
+    {
+        uint64_t Epoch;
+        std::function<void()> Deleter;
+    };
+
+    // Records are never freed, only reused by later threads
+    std::atomic<ThreadRecord*> ThreadRecords {nullptr};
+    std::atomic<uint64_t> GlobalEpoch {1};
+
+    std::vector<RetiredObject> RetiredObjects;
+    std::mutex RetiredMutex;
+
+    ThreadRecord* AcquireRecord()
+    {
+        for (ThreadRecord* record = ThreadRecords.load(std::memory_order_acquire); record; record = record->Next)
+        {
+            bool expected = false;
+
+            if (!record->InUse.load(std::memory_order_relaxed) && record->InUse.compare_exchange_strong(expected, true))
+            {
+                return record;
+            }
+        }
+
+        ThreadRecord* record = new ThreadRecord();
+        record->InUse.store(true, std::memory_order_relaxed);
+
+        ThreadRecord* head = ThreadRecords.load(std::memory_order_relaxed);
+
+        do
+        {
+            record->Next = head;
+        } while (!ThreadRecords.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+        return record;
+    }
+
+    struct ThreadState
+    {
+        ThreadRecord* Record = AcquireRecord();
+        size_t Depth = 0;
+
+        ~ThreadState()
+        {
+            Record->Epoch.store(0, std::memory_order_release);
+            Record->InUse.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local ThreadState CurrentThread;
+}
+
+EpochReclaimer::Guard::Guard()
+{
+    ThreadState& state = CurrentThread;
+
+    if (state.Depth++ == 0)
+    {
+        state.Record->Epoch.store(GlobalEpoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+
+        // The pinned epoch must be visible before any pointer is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+EpochReclaimer::Guard::~Guard()
+{
+    ThreadState& state = CurrentThread;
+
+    if (--state.Depth == 0)
+    {
+        state.Record->Epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochReclaimer::Retire(std::function<void()> deleter)
+{
+    {
+        std::lock_guard<std::mutex> guard(RetiredMutex);
+
+        // The object was unlinked before this, so readers pinned after the increment can't reach it
+        RetiredObjects.push_back({ GlobalEpoch.fetch_add(1, std::memory_order_seq_cst), std::move(deleter) });
+    }
+
+    Collect();
+}
+
+void EpochReclaimer::Collect()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t oldest = UINT64_MAX;
+
+    for (ThreadRecord* record = ThreadRecords.load(std::memory_order_acquire); record; record = record->Next)
+    {
+        const uint64_t epoch = record->Epoch.load(std::memory_order_acquire);
+
+        if (epoch != 0)
+        {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+
+    std::vector<RetiredObject> reclaimed;
+
+    {
+        std::lock_guard<std::mutex> guard(RetiredMutex);
+
+        auto split = std::partition(RetiredObjects.begin(), RetiredObjects.end(), [oldest] (const RetiredObject& object)
+        {
+            return object.Epoch >= oldest;
+        });
+
+        reclaimed.assign(std::make_move_iterator(split), std::make_move_iterator(RetiredObjects.end()));
+        RetiredObjects.erase(split, RetiredObjects.end());
+    }
+
+    for (RetiredObject& object : reclaimed)
+    {
+        object.Deleter();
+    }
+}
@@ -0,0 +1,363 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "HookStatistics.h"
+#include "PatchBuilder.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace
+{
+    // Only ever written by the thread owning it, so a plain load and store is enough
+    struct Counter
+    {
+        std::atomic<uint64_t> Value {0};
+
+        void Add(uint64_t amount = 1)
+        {
+            Value.store(Value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        uint64_t Get() const
+        {
+            return Value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Claimed by storing the address, then publishing the first hit
+    struct PatchSlot
+    {
+        std::atomic<uintptr_t> Address {0};
+        Counter Hits;
+    };
+
+    static const size_t PatchSlotBits = 12;
+    static const size_t MaxProbes = 8;
+
+    struct alignas(64) ThreadRecord
+    {
+        Counter Calls;
+        Counter Hits;
+        Counter Failures;
+        Counter UntrackedHits;
+        Counter Lookup[HookStatistics::BucketCount];
+        Counter Evaluate[HookStatistics::BucketCount];
+
+        // Open addressed by patch address. Slots are never freed, so once a patch's probes are all taken by others,
+        // its hits are only counted as untracked rather than allocating or locking while lifting.
+        PatchSlot PatchHits[size_t(1) << PatchSlotBits];
+
+        std::atomic<bool> InUse {false};
+        ThreadRecord* Next = nullptr;
+    };
+
+    // Records are never freed, and keep their counts when reused by a later thread
+    std::atomic<ThreadRecord*> ThreadRecords {nullptr};
+
+    HookStatistics::Snapshot Baseline;
+    std::mutex BaselineMutex;
+
+    ThreadRecord* AcquireRecord()
+    {
+        for (ThreadRecord* record = ThreadRecords.load(std::memory_order_acquire); record; record = record->Next)
+        {
+            bool expected = false;
+
+            if (!record->InUse.load(std::memory_order_relaxed) && record->InUse.compare_exchange_strong(expected, true))
+            {
+                return record;
+            }
+        }
+
+        ThreadRecord* record = new ThreadRecord();
+        record->InUse.store(true, std::memory_order_relaxed);
+
+        ThreadRecord* head = ThreadRecords.load(std::memory_order_relaxed);
+
+        do
+        {
+            record->Next = head;
+        } while (!ThreadRecords.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+        return record;
+    }
+
+    struct ThreadRecordHolder
+    {
+        ThreadRecord* Record = AcquireRecord();
+
+        ~ThreadRecordHolder()
+        {
+            Record->InUse.store(false, std::memory_order_release);
+        }
+    };
+
+    ThreadRecord& GetThreadRecord()
+    {
+        thread_local ThreadRecordHolder holder;
+
+        return *holder.Record;
+    }
+
+    size_t GetBucket(HookStatistics::Clock::duration elapsed)
+    {
+        uint64_t nanoseconds = static_cast<uint64_t>(std::max<int64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 1));
+
+        size_t bucket = 0;
+
+        while ((nanoseconds >>= 1) && (bucket + 1 < HookStatistics::BucketCount))
+        {
+            ++bucket;
+        }
+
+        return bucket;
+    }
+
+    // The upper bound of the bucket holding the given fraction of the samples
+    uint64_t GetPercentile(const uint64_t (&buckets)[HookStatistics::BucketCount], double fraction)
+    {
+        uint64_t total = 0;
+
+        for (uint64_t count : buckets)
+        {
+            total += count;
+        }
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        uint64_t target = std::min<uint64_t>(static_cast<uint64_t>(total * fraction), total - 1);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < HookStatistics::BucketCount; ++i)
+        {
+            seen += buckets[i];
+
+            if (seen > target)
+            {
+                return uint64_t(2) << i;
+            }
+        }
+
+        return 0;
+    }
+
+    void LogHistogram(const char* name, const uint64_t (&buckets)[HookStatistics::BucketCount])
+    {
+        uint64_t total = 0;
+
+        for (uint64_t count : buckets)
+        {
+            total += count;
+        }
+
+        BinjaLog(InfoLog, "{0}: {1} samples (1 in {6} calls), p50 < {2} ns, p90 < {3} ns, p99 < {4} ns, max < {5} ns", name, total,
+            GetPercentile(buckets, 0.5), GetPercentile(buckets, 0.9), GetPercentile(buckets, 0.99), GetPercentile(buckets, 1.0), HookStatistics::TimingInterval);
+    }
+
+    HookStatistics::Snapshot CollectTotals()
+    {
+        HookStatistics::Snapshot totals;
+
+        std::unordered_map<uintptr_t, uint64_t> patch_hits;
+
+        for (ThreadRecord* record = ThreadRecords.load(std::memory_order_acquire); record; record = record->Next)
+        {
+            totals.Calls += record->Calls.Get();
+            totals.Hits += record->Hits.Get();
+            totals.Failures += record->Failures.Get();
+            totals.UntrackedHits += record->UntrackedHits.Get();
+
+            for (size_t i = 0; i < HookStatistics::BucketCount; ++i)
+            {
+                totals.Lookup[i] += record->Lookup[i].Get();
+                totals.Evaluate[i] += record->Evaluate[i].Get();
+            }
+
+            for (const PatchSlot& slot : record->PatchHits)
+            {
+                const uint64_t hits = slot.Hits.Value.load(std::memory_order_acquire);
+
+                if (hits != 0)
+                {
+                    patch_hits[slot.Address.load(std::memory_order_relaxed)] += hits;
+                }
+            }
+        }
+
+        totals.PatchHits.assign(patch_hits.begin(), patch_hits.end());
+
+        std::sort(totals.PatchHits.begin(), totals.PatchHits.end());
+
+        return totals;
+    }
+}
+
+void HookStatistics::RecordLookup(uintptr_t address, bool hit)
+{
+    ThreadRecord& record = GetThreadRecord();
+
+    record.Calls.Add();
+
+    if (!hit)
+    {
+        return;
+    }
+
+    record.Hits.Add();
+
+    const size_t mask = (size_t(1) << PatchSlotBits) - 1;
+    const size_t start = static_cast<size_t>((static_cast<uint64_t>(address) * 0x9E3779B97F4A7C15ULL) >> (64 - PatchSlotBits));
+
+    for (size_t i = 0; i < MaxProbes; ++i)
+    {
+        PatchSlot& slot = record.PatchHits[(start + i) & mask];
+
+        if (slot.Hits.Get() == 0)
+        {
+            slot.Address.store(address, std::memory_order_relaxed);
+            slot.Hits.Value.store(1, std::memory_order_release);
+
+            return;
+        }
+
+        if (slot.Address.load(std::memory_order_relaxed) == address)
+        {
+            slot.Hits.Add();
+
+            return;
+        }
+    }
+
+    record.UntrackedHits.Add();
+}
+
+void HookStatistics::RecordEvaluate(bool success)
+{
+    if (!success)
+    {
+        GetThreadRecord().Failures.Add();
+    }
+}
+
+bool HookStatistics::ShouldTime()
+{
+    static_assert((TimingInterval & (TimingInterval - 1)) == 0, "TimingInterval must be a power of two");
+
+    thread_local uint32_t calls = 0;
+
+    return (++calls & (TimingInterval - 1)) == 0;
+}
+
+void HookStatistics::RecordLookupTime(Clock::duration elapsed)
+{
+    GetThreadRecord().Lookup[GetBucket(elapsed)].Add();
+}
+
+void HookStatistics::RecordEvaluateTime(Clock::duration elapsed)
+{
+    GetThreadRecord().Evaluate[GetBucket(elapsed)].Add();
+}
+
+HookStatistics::Snapshot HookStatistics::Collect()
+{
+    Snapshot totals = CollectTotals();
+
+    std::lock_guard<std::mutex> guard(BaselineMutex);
+
+    totals.Calls -= Baseline.Calls;
+    totals.Hits -= Baseline.Hits;
+    totals.Failures -= Baseline.Failures;
+    totals.UntrackedHits -= Baseline.UntrackedHits;
+
+    for (size_t i = 0; i < BucketCount; ++i)
+    {
+        totals.Lookup[i] -= Baseline.Lookup[i];
+        totals.Evaluate[i] -= Baseline.Evaluate[i];
+    }
+
+    // Both are sorted by address
+    auto base = Baseline.PatchHits.begin();
+
+    for (auto& hits : totals.PatchHits)
+    {
+        while ((base != Baseline.PatchHits.end()) && (base->first < hits.first))
+        {
+            ++base;
+        }
+
+        if ((base != Baseline.PatchHits.end()) && (base->first == hits.first))
+        {
+            hits.second -= base->second;
+        }
+    }
+
+    totals.PatchHits.erase(std::remove_if(totals.PatchHits.begin(), totals.PatchHits.end(),
+        [ ] (const std::pair<uintptr_t, uint64_t>& hits) { return hits.second == 0; }), totals.PatchHits.end());
+
+    return totals;
+}
+
+void HookStatistics::Reset()
+{
+    // The records are owned by their threads, so rather than clearing them, remember where they were
+    Snapshot totals = CollectTotals();
+
+    std::lock_guard<std::mutex> guard(BaselineMutex);
+
+    Baseline = std::move(totals);
+}
+
+void HookStatistics::Log(BinaryView& view, size_t top)
+{
+    Snapshot totals = Collect();
+
+    BinjaLog(InfoLog, "Hook: {0} calls, {1} patch hits ({2} untracked), {3} failed evaluations",
+        totals.Calls, totals.Hits, totals.UntrackedHits, totals.Failures);
+
+    LogHistogram("GetPatch", totals.Lookup);
+    LogHistogram("Evaluate", totals.Evaluate);
+
+    PatchBuilder::PatchStatistics patches = PatchBuilder::GetPatchStatistics(view);
+
+    BinjaLog(InfoLog, "Patches: {0} loaded, {1} token bytes ({2} in parameters), {3} templates",
+        patches.Loaded.Count, patches.Loaded.TokenBytes, patches.Loaded.ParamBytes, patches.Templates);
+
+    BinjaLog(InfoLog, "Patches: {0} in {1} unloaded chunks, {2} token bytes ({3} in parameters), {4} imported records not yet used",
+        patches.Unloaded.Count, patches.UnloadedChunks, patches.Unloaded.TokenBytes, patches.Unloaded.ParamBytes, patches.UnloadedImports);
+
+    std::sort(totals.PatchHits.begin(), totals.PatchHits.end(),
+        [ ] (const std::pair<uintptr_t, uint64_t>& lhs, const std::pair<uintptr_t, uint64_t>& rhs)
+    {
+        return lhs.second > rhs.second;
+    });
+
+    if (totals.PatchHits.size() > top)
+    {
+        totals.PatchHits.resize(top);
+    }
+
+    for (const auto& hits : totals.PatchHits)
+    {
+        BinjaLog(InfoLog, "  0x{0:x}: {1} hits", hits.first, hits.second);
+    }
+}
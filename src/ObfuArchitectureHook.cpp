@@ -15,16 +15,52 @@
 
 #include "ObfuArchitectureHook.h"
 #include "PatchBuilder.h"
+#include "HookStatistics.h"
+#include "EpochReclaimer.h"
 
 bool ObfuArchitectureHook::GetInstructionLowLevelIL(const uint8_t* data, uint64_t addr, size_t& len, LowLevelILFunction& il)
 {
+    EpochReclaimer::Guard epoch;
+
+    const bool timing = HookStatistics::ShouldTime();
+
+    HookStatistics::Clock::time_point start;
+
+    if (timing)
+    {
+        start = HookStatistics::Clock::now();
+    }
+
     const PatchBuilder::Patch* patch = PatchBuilder::GetPatch(il, addr);
 
-    if (patch && patch->Evaluate(il))
+    if (timing)
     {
-        len = patch->Size;
+        HookStatistics::Clock::time_point found = HookStatistics::Clock::now();
+
+        HookStatistics::RecordLookupTime(found - start);
+
+        start = found;
+    }
+
+    HookStatistics::RecordLookup(addr, patch != nullptr);
+
+    if (patch)
+    {
+        bool evaluated = patch->Evaluate(il);
+
+        if (timing)
+        {
+            HookStatistics::RecordEvaluateTime(HookStatistics::Clock::now() - start);
+        }
+
+        HookStatistics::RecordEvaluate(evaluated);
+
+        if (evaluated)
+        {
+            len = patch->Size;
 
-        return true;
+            return true;
+        }
     }
 
     return ArchitectureHook::GetInstructionLowLevelIL(data, addr, len, il);
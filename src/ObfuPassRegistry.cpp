@@ -0,0 +1,180 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ObfuPassRegistry.h"
+#include "TraceRecorder.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+namespace
+{
+    std::vector<std::unique_ptr<ObfuPass>> Passes;
+    std::mutex PassesMutex;
+}
+
+ObfuPass::ObfuPass(std::string name, std::string title, std::string description, Stage stage, int order, bool enabled, Callback callback)
+    : m_Name(std::move(name))
+    , m_Title(std::move(title))
+    , m_Description(std::move(description))
+    , m_Stage(stage)
+    , m_Order(order)
+    , m_DefaultEnabled(enabled)
+    , m_Callback(std::move(callback))
+{ }
+
+const std::string& ObfuPass::GetName() const
+{
+    return m_Name;
+}
+
+ObfuPass::Stage ObfuPass::GetStage() const
+{
+    return m_Stage;
+}
+
+int ObfuPass::GetOrder() const
+{
+    return m_Order;
+}
+
+std::string ObfuPass::GetSettingName() const
+{
+    return "obfu.passes." + m_Name;
+}
+
+std::string ObfuPass::GetSettingProperties() const
+{
+    return fmt::format(R"({{ "title" : "{0}", "type" : "boolean", "default" : {1}, "description" : "{2}" }})",
+        m_Title, m_DefaultEnabled ? "true" : "false", m_Description);
+}
+
+bool ObfuPass::IsEnabled(BinaryView* view) const
+{
+    return Settings::Instance()->Get<bool>(GetSettingName(), view);
+}
+
+PassResult ObfuPass::Run(BinaryView* view, Function* func, PassState& state)
+{
+    TraceSpan span((m_Stage == Stage::Fix) ? "fixer" : "label", m_Name.c_str());
+
+    auto start = std::chrono::steady_clock::now();
+
+    PassResult result = m_Callback(view, func, state);
+
+    if (span.IsRecording())
+    {
+        span.SetArg("visited", std::to_string(result.Visited));
+        span.SetArg("patches", std::to_string(result.Patches));
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    m_Runs.fetch_add(1, std::memory_order_relaxed);
+    m_Nanoseconds.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+    m_Visited.fetch_add(result.Visited, std::memory_order_relaxed);
+    m_Patches.fetch_add(result.Patches, std::memory_order_relaxed);
+
+    return result;
+}
+
+void ObfuPass::LogStatistics() const
+{
+    BinjaLog(InfoLog, "{0}: {1} runs, {2:.3f} ms, {3} visited, {4} patches", m_Name,
+        m_Runs.load(), m_Nanoseconds.load() / 1000000.0, m_Visited.load(), m_Patches.load());
+}
+
+void ObfuPass::ResetStatistics()
+{
+    m_Runs = 0;
+    m_Nanoseconds = 0;
+    m_Visited = 0;
+    m_Patches = 0;
+}
+
+ObfuPass* ObfuPassRegistry::Register(std::unique_ptr<ObfuPass> pass)
+{
+    std::lock_guard<std::mutex> guard(PassesMutex);
+
+    Ref<Settings> settings = Settings::Instance();
+
+    if (Passes.empty())
+    {
+        settings->RegisterGroup("obfu", "Obfuscation");
+    }
+
+    settings->RegisterSetting(pass->GetSettingName(), pass->GetSettingProperties());
+
+    ObfuPass* result = pass.get();
+
+    // Keep them sorted, so lookups don't need to
+    auto position = std::upper_bound(Passes.begin(), Passes.end(), pass,
+        [ ] (const std::unique_ptr<ObfuPass>& lhs, const std::unique_ptr<ObfuPass>& rhs)
+    {
+        return std::make_pair(lhs->GetStage(), lhs->GetOrder()) < std::make_pair(rhs->GetStage(), rhs->GetOrder());
+    });
+
+    Passes.insert(position, std::move(pass));
+
+    return result;
+}
+
+std::vector<ObfuPass*> ObfuPassRegistry::GetPasses(ObfuPass::Stage stage, BinaryView* view)
+{
+    std::vector<ObfuPass*> results;
+
+    {
+        std::lock_guard<std::mutex> guard(PassesMutex);
+
+        for (const std::unique_ptr<ObfuPass>& pass : Passes)
+        {
+            if (pass->GetStage() == stage)
+            {
+                results.push_back(pass.get());
+            }
+        }
+    }
+
+    // Passes are never unregistered, so they can be checked against the settings without holding the lock
+    results.erase(std::remove_if(results.begin(), results.end(), [view] (ObfuPass* pass)
+    {
+        return !pass->IsEnabled(view);
+    }), results.end());
+
+    return results;
+}
+
+void ObfuPassRegistry::LogStatistics()
+{
+    std::lock_guard<std::mutex> guard(PassesMutex);
+
+    for (const std::unique_ptr<ObfuPass>& pass : Passes)
+    {
+        pass->LogStatistics();
+    }
+}
+
+void ObfuPassRegistry::ResetStatistics()
+{
+    std::lock_guard<std::mutex> guard(PassesMutex);
+
+    for (const std::unique_ptr<ObfuPass>& pass : Passes)
+    {
+        pass->ResetStatistics();
+    }
+}
@@ -17,10 +17,430 @@
 #include "MLIL_SSA.h"
 #include "MLIL.h"
 #include "PatchBuilder.h"
+#include "FunctionAssociatedDataStore.h"
+#include "AnalysisUpdateNotification.h"
+#include "WorkStealingPool.h"
+#include "ObfuPassRegistry.h"
+#include "TraceRecorder.h"
 
 #include "fmt/format.h"
 
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+void Flatten(std::vector<PatchBuilder::Token>& patches, const LowLevelILInstruction& insn);
+
+// Facts about one generation of a function's LLIL, shared by every pass run against it
+struct FunctionSummary
+{
+    struct Block
+    {
+        // The block's last instruction
+        size_t Exit;
+        uint64_t Address;
+        BNLowLevelILOperation Operation;
+        RegisterValue StackRegisterValue;
+
+        // Covers the block's IL and the stack values the fixers read from it.
+        // Expressions are flattened, so it doesn't depend on where they sit in the function's IL.
+        uint64_t Fingerprint;
+
+        std::vector<size_t> Successors;
+    };
+
+    // reg = pop instructions, the candidates for FixStack
+    struct StackPop
+    {
+        size_t Index;
+        size_t Block;
+    };
+
+    // Indexed by the IL block index
+    std::vector<Block> Blocks;
+
+    // Covers every block, so it only repeats if the function's IL and stack values do
+    uint64_t Fingerprint;
+
+    std::vector<StackPop> Pops;
+
+    size_t GetMemoryUsage() const
+    {
+        size_t total = sizeof(*this) + (Blocks.capacity() * sizeof(Block)) + (Pops.capacity() * sizeof(StackPop));
+
+        for (const Block& block : Blocks)
+        {
+            total += block.Successors.capacity() * sizeof(size_t);
+        }
+
+        return total;
+    }
+};
+
+FunctionAssociatedDataStore<FunctionSummary> FunctionSummaries;
+
+// Also drops the summary of any function analysis updates while deobfuscating, including reanalysis nothing here asked for
+class SummaryUpdateNotification
+    : public AnalysisUpdateNotification
+{
+public:
+    SummaryUpdateNotification(Ref<BinaryView> view)
+        : AnalysisUpdateNotification(view)
+    { }
+
+    void OnAnalysisFunctionUpdated(BinaryView* view, Function* func) override
+    {
+        FunctionSummaries.Evict(func->m_object);
+
+        AnalysisUpdateNotification::OnAnalysisFunctionUpdated(view, func);
+    }
+
+    void OnAnalysisFunctionRemoved(BinaryView* view, Function* func) override
+    {
+        FunctionSummaries.Evict(func->m_object);
+
+        AnalysisUpdateNotification::OnAnalysisFunctionRemoved(view, func);
+    }
+};
+
+uint64_t HashCombine(uint64_t hash, uint64_t value)
+{
+    return (hash ^ value) * 0x100000001B3ULL;
+}
+
+uint64_t HashRegisterValue(uint64_t hash, const RegisterValue& value)
+{
+    return HashCombine(HashCombine(hash, value.state), static_cast<uint64_t>(value.value));
+}
+
+// Summaries are keyed on the IL's address without referencing it, as that would keep the function alive.
+// The address can be reused once the IL is freed, so a function's summary is evicted whenever it's reanalyzed.
+std::shared_ptr<const FunctionSummary> GetFunctionSummary(Function* func, LowLevelILFunction* llil)
+{
+    return FunctionSummaries.GetOrCreate(func->m_object, llil->m_object, [&]
+    {
+        std::shared_ptr<FunctionSummary> summary = std::make_shared<FunctionSummary>();
+
+        const uint32_t stack_register = llil->GetArchitecture()->GetStackPointerRegister();
+
+        std::vector<Ref<BasicBlock>> blocks = llil->GetBasicBlocks();
+
+        summary->Blocks.resize(blocks.size());
+
+        std::vector<PatchBuilder::Token> tokens;
+
+        for (Ref<BasicBlock> block : blocks)
+        {
+            const size_t block_index = block->GetIndex();
+
+            uint64_t hash = 0xCBF29CE484222325ULL;
+
+            for (size_t i = block->GetStart(); i < block->GetEnd(); ++i)
+            {
+                LowLevelILInstruction insn = llil->GetInstruction(i);
+
+                tokens.clear();
+                Flatten(tokens, insn);
+
+                hash = HashCombine(hash, insn.address);
+
+                for (const PatchBuilder::Token& token : tokens)
+                {
+                    hash = HashCombine(HashCombine(hash, static_cast<uint64_t>(token.Type)), token.Value);
+                }
+
+                if ((insn.operation == LLIL_SET_REG) && (insn.As<LLIL_SET_REG>().GetSourceExpr().operation == LLIL_POP))
+                {
+                    summary->Pops.push_back({ i, block_index });
+
+                    hash = HashRegisterValue(hash, insn.GetRegisterValue(stack_register));
+                }
+            }
+
+            LowLevelILInstruction last = llil->GetInstruction(block->GetEnd() - 1);
+
+            FunctionSummary::Block& info = summary->Blocks.at(block_index);
+
+            info.Exit = last.instructionIndex;
+            info.Address = last.address;
+            info.Operation = last.operation;
+            info.StackRegisterValue = last.GetRegisterValue(stack_register);
+            info.Fingerprint = HashRegisterValue(hash, info.StackRegisterValue);
+
+            for (const BasicBlockEdge& edge : block->GetOutgoingEdges())
+            {
+                if (edge.target)
+                {
+                    info.Successors.push_back(edge.target->GetIndex());
+                }
+            }
+        }
+
+        summary->Pops.shrink_to_fit();
+
+        summary->Fingerprint = 0xCBF29CE484222325ULL;
+
+        for (const FunctionSummary::Block& block : summary->Blocks)
+        {
+            summary->Fingerprint = HashCombine(summary->Fingerprint, block.Fingerprint);
+        }
+
+        return summary;
+    });
+}
+
+// Fingerprints of blocks that every fixer has looked at without finding anything to patch
+class BlockWorklist
+{
+protected:
+    std::unordered_set<uint64_t> m_Settled;
+
+public:
+    bool IsSettled(uint64_t fingerprint) const
+    {
+        return m_Settled.find(fingerprint) != m_Settled.end();
+    }
+
+    void Settle(uint64_t fingerprint)
+    {
+        m_Settled.insert(fingerprint);
+    }
+};
+
+enum class StopReason
+{
+    None,
+    Converged,
+    Cycle,
+    OutOfTime,
+    OutOfWork,
+    Cancelled,
+};
+
+// Decides when to stop patching a function: once a pass finds nothing, once the function returns to a state
+// it has already been in, or once it has used up its time or patch budget.
+// Only time charged to the function counts towards its budget, so functions patched together in a batch don't
+// use up each other's time.
+class ConvergenceTracker
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+protected:
+    // Function fingerprint -> the pass it was first seen in
+    std::unordered_map<uint64_t, size_t> m_States;
+
+    // Address -> hash of the first patch emitted there, since a later one at the same address never replaces it.
+    // The patches are part of the state, as they may not show up in the IL until the function is reanalyzed.
+    std::unordered_map<uintptr_t, uint64_t> m_Emitted;
+    uint64_t m_EmittedHash = 0;
+
+    Clock::duration m_Elapsed {0};
+    size_t m_Passes = 0;
+    size_t m_Patches = 0;
+    size_t m_CycleStart = 0;
+    StopReason m_Reason = StopReason::None;
+
+public:
+    static constexpr std::chrono::seconds TimeBudget {60};
+    static const size_t WorkBudget = 0x4000;
+
+    // Called with the time spent on the function, including its share of any reanalysis
+    void Charge(Clock::duration elapsed)
+    {
+        m_Elapsed += elapsed;
+    }
+
+    // Called with the function's state at the start of each pass
+    StopReason Observe(uint64_t fingerprint)
+    {
+        ++m_Passes;
+
+        auto insert = m_States.emplace(HashCombine(fingerprint, m_EmittedHash), m_Passes);
+
+        if (!insert.second)
+        {
+            m_CycleStart = insert.first->second;
+
+            return Stop(StopReason::Cycle);
+        }
+
+        return StopReason::None;
+    }
+
+    // Called with each patch emitted during a pass
+    void Emit(uintptr_t address, uint64_t hash)
+    {
+        if (m_Emitted.emplace(address, hash).second)
+        {
+            // Summed, so the state doesn't depend on the order the patches were emitted in
+            m_EmittedHash += HashCombine(HashCombine(0xCBF29CE484222325ULL, address), hash);
+        }
+    }
+
+    // Called with the number of patches made at the end of each pass
+    StopReason Record(size_t patches)
+    {
+        m_Patches += patches;
+
+        if (patches == 0)
+        {
+            return Stop(StopReason::Converged);
+        }
+
+        if (m_Patches >= WorkBudget)
+        {
+            return Stop(StopReason::OutOfWork);
+        }
+
+        if (m_Elapsed >= TimeBudget)
+        {
+            return Stop(StopReason::OutOfTime);
+        }
+
+        return StopReason::None;
+    }
+
+    StopReason Stop(StopReason reason)
+    {
+        m_Reason = reason;
+
+        return reason;
+    }
+
+    StopReason GetReason() const
+    {
+        return m_Reason;
+    }
+
+    size_t GetPasses() const
+    {
+        return m_Passes;
+    }
+
+    std::string Describe() const
+    {
+        switch (m_Reason)
+        {
+            case StopReason::Converged:
+                return "converged";
+
+            case StopReason::Cycle:
+                return fmt::format("cycled back to pass {0}", m_CycleStart);
+
+            case StopReason::OutOfTime:
+                return fmt::format("out of time after {0} ms",
+                    std::chrono::duration_cast<std::chrono::milliseconds>(m_Elapsed).count());
+
+            case StopReason::OutOfWork:
+                return fmt::format("out of work after {0} patches", m_Patches);
+
+            case StopReason::Cancelled:
+                return "cancelled";
+
+            default:
+                return "unfinished";
+        }
+    }
+};
+
+// The blocks one pass needs to look at: any block that isn't settled, and everything reachable from it,
+// since its dataflow may have changed too
+class PassState
+{
+protected:
+    Ref<LowLevelILFunction> m_LLIL;
+    std::shared_ptr<const FunctionSummary> m_Summary;
+    std::vector<uint8_t> m_Pending;
+    std::vector<uint8_t> m_Patched;
+
+    // Address and hash of each patch emitted
+    std::vector<std::pair<uintptr_t, uint64_t>> m_Emitted;
+
+public:
+    PassState(Ref<LowLevelILFunction> llil, std::shared_ptr<const FunctionSummary> summary, const BlockWorklist& worklist)
+        : m_LLIL(std::move(llil))
+        , m_Summary(std::move(summary))
+        , m_Pending(m_Summary->Blocks.size())
+        , m_Patched(m_Summary->Blocks.size())
+    {
+        std::vector<size_t> stack;
+
+        for (size_t i = 0; i < m_Summary->Blocks.size(); ++i)
+        {
+            if (!worklist.IsSettled(m_Summary->Blocks[i].Fingerprint))
+            {
+                m_Pending[i] = true;
+                stack.push_back(i);
+            }
+        }
+
+        while (!stack.empty())
+        {
+            size_t index = stack.back();
+            stack.pop_back();
+
+            for (size_t successor : m_Summary->Blocks[index].Successors)
+            {
+                if (!m_Pending.at(successor))
+                {
+                    m_Pending[successor] = true;
+                    stack.push_back(successor);
+                }
+            }
+        }
+    }
+
+    // The IL the summary was derived from, only referenced for as long as the pass runs
+    LowLevelILFunction* GetLLIL() const
+    {
+        return m_LLIL;
+    }
+
+    const FunctionSummary& GetSummary() const
+    {
+        return *m_Summary;
+    }
+
+    bool IsPending(size_t block) const
+    {
+        return m_Pending[block];
+    }
+
+    void AddPatch(BinaryView* view, size_t block, uintptr_t address, size_t size, const std::vector<PatchBuilder::Token>& tokens)
+    {
+        uint64_t hash = HashCombine(0xCBF29CE484222325ULL, size);
+
+        for (const PatchBuilder::Token& token : tokens)
+        {
+            hash = HashCombine(HashCombine(hash, static_cast<uint64_t>(token.Type)), token.Value);
+        }
+
+        PatchBuilder::AddPatch(*view, address, PatchBuilder::Patch(size, tokens));
+
+        m_Patched[block] = true;
+        m_Emitted.emplace_back(address, hash);
+    }
+
+    const std::vector<std::pair<uintptr_t, uint64_t>>& GetEmitted() const
+    {
+        return m_Emitted;
+    }
+
+    // Blocks which were looked at and left alone won't be looked at again, until their fingerprint changes
+    void Settle(BlockWorklist& worklist) const
+    {
+        for (size_t i = 0; i < m_Summary->Blocks.size(); ++i)
+        {
+            if (m_Pending[i] && !m_Patched[i])
+            {
+                worklist.Settle(m_Summary->Blocks[i].Fingerprint);
+            }
+        }
+    }
+};
 
 bool CheckTailXrefs(BinaryView* view, Function* func, Function* tail)
 {
@@ -42,21 +462,20 @@ bool CheckTailXrefs(BinaryView* view, Function* func, Function* tail)
     return funcs.size() == 0;
 }
 
-size_t FixTails(BinaryView* view, Function* func)
+// Checks every block regardless of the worklist, since whether a tail can be removed depends on other functions
+PassResult FixTails(BinaryView* view, Function* func, PassState& state)
 {
     size_t total = 0;
 
-    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+    const FunctionSummary& summary = state.GetSummary();
 
-    for (Ref<BasicBlock> block : llil->GetBasicBlocks())
+    for (const FunctionSummary::Block& block : summary.Blocks)
     {
-        LowLevelILInstruction last = llil->GetInstruction(block->GetEnd() - 1);
-
         Ref<Function> tail;
 
-        if (last.operation == LLIL_TAILCALL || last.operation == LLIL_JUMP)
+        if (block.Operation == LLIL_TAILCALL || block.Operation == LLIL_JUMP)
         {
-            LowLevelILInstruction dest = last.GetDestExpr();
+            LowLevelILInstruction dest = state.GetLLIL()->GetInstruction(block.Exit).GetDestExpr();
 
             PossibleValueSet branchSet = dest.GetPossibleValues();
 
@@ -95,7 +514,7 @@ size_t FixTails(BinaryView* view, Function* func)
         ++total;
     }
 
-    return total;
+    return { summary.Blocks.size(), total };
 }
 
 void Flatten(std::vector<PatchBuilder::Token>& patches, const LowLevelILInstruction& insn)
@@ -165,149 +584,151 @@ bool AreValuesExecutable(BinaryView& view, const PossibleValueSet& values)
     return false;
 }
 
-size_t FixStack(BinaryView* view, Function* func)
+PassResult FixStack(BinaryView* view, Function* func, PassState& state)
 {
     size_t total = 0;
+    size_t visited = 0;
 
-    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+    const FunctionSummary& summary = state.GetSummary();
+    Ref<LowLevelILFunction> llil = state.GetLLIL();
 
     const uint32_t stack_register = llil->GetArchitecture()->GetStackPointerRegister();
     const size_t address_size = view->GetAddressSize();
 
-    for (Ref<BasicBlock> block : llil->GetBasicBlocks())
+    for (const FunctionSummary::StackPop& pop : summary.Pops)
     {
-        for (size_t i = block->GetStart(); i < block->GetEnd(); ++i)
+        if (!state.IsPending(pop.Block))
         {
-            LowLevelILInstruction insn = llil->GetInstruction(i);
+            continue;
+        }
 
-            if (insn.operation != LLIL_SET_REG)
-            {
-                continue;
-            }
+        ++visited;
 
-            LowLevelILInstruction src = insn.As<LLIL_SET_REG>().GetSourceExpr();
+        LowLevelILInstruction insn = llil->GetInstruction(pop.Index);
 
-            if (src.operation != LLIL_POP)
-            {
-                continue;
-            }
-
-            RegisterValue stack_register_value_before = insn.GetRegisterValue(stack_register);
+        RegisterValue stack_register_value_before = insn.GetRegisterValue(stack_register);
 
-            if (stack_register_value_before.state != StackFrameOffset)
-            {
-                continue;
-            }
+        if (stack_register_value_before.state != StackFrameOffset)
+        {
+            continue;
+        }
 
-            RegisterValue stack_register_value_after;
-            stack_register_value_after.state = StackFrameOffset;
-            stack_register_value_after.value = stack_register_value_before.value + address_size;
+        RegisterValue stack_register_value_after;
+        stack_register_value_after.state = StackFrameOffset;
+        stack_register_value_after.value = stack_register_value_before.value + address_size;
 
-            uint32_t dest_register = insn.As<LLIL_SET_REG>().GetDestRegister();
+        uint32_t dest_register = insn.As<LLIL_SET_REG>().GetDestRegister();
 
-            if (LLIL_REG_IS_TEMP(dest_register))
-            {
-                continue;
-            }
+        if (LLIL_REG_IS_TEMP(dest_register))
+        {
+            continue;
+        }
 
-            RegisterValue dest_register_value_after = insn.GetRegisterValueAfter(dest_register);
+        RegisterValue dest_register_value_after = insn.GetRegisterValueAfter(dest_register);
 
-            if (dest_register_value_after.state != StackFrameOffset)
-            {
-                continue;
-            }
+        if (dest_register_value_after.state != StackFrameOffset)
+        {
+            continue;
+        }
 
-            std::vector<PatchBuilder::Token> patches;
+        std::vector<PatchBuilder::Token> patches;
 
-            patches.insert(patches.end(), std::initializer_list<PatchBuilder::Token> {
-                        { PatchBuilder::TokenType::Operand, stack_register },
-                                { PatchBuilder::TokenType::Operand, stack_register },
-                            { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
-                            { PatchBuilder::TokenType::Operand, 0 }, // Flags
-                            { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                            { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_REG },
-                        { PatchBuilder::TokenType::Operand, static_cast<size_t>(stack_register_value_after.value - stack_register_value_before.value) },
+        patches.insert(patches.end(), std::initializer_list<PatchBuilder::Token> {
+                    { PatchBuilder::TokenType::Operand, stack_register },
+                            { PatchBuilder::TokenType::Operand, stack_register },
                         { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
                         { PatchBuilder::TokenType::Operand, 0 }, // Flags
                         { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                        { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_CONST },
-                    { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
+                        { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_REG },
+                    { PatchBuilder::TokenType::Operand, static_cast<size_t>(stack_register_value_after.value - stack_register_value_before.value) },
+                    { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
                     { PatchBuilder::TokenType::Operand, 0 }, // Flags
                     { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                    { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_ADD },
+                    { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_CONST },
                 { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
                 { PatchBuilder::TokenType::Operand, 0 }, // Flags
                 { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_SET_REG },
-            });
-
-            patches.insert(patches.end(), std::initializer_list<PatchBuilder::Token> {
-                        { PatchBuilder::TokenType::Operand, dest_register },
-                                { PatchBuilder::TokenType::Operand, stack_register },
-                            { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
-                            { PatchBuilder::TokenType::Operand, 0 }, // Flags
-                            { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                            { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_REG },
-                        { PatchBuilder::TokenType::Operand, static_cast<size_t>(dest_register_value_after.value - stack_register_value_after.value) },
+                { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_ADD },
+            { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
+            { PatchBuilder::TokenType::Operand, 0 }, // Flags
+            { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
+            { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_SET_REG },
+        });
+
+        patches.insert(patches.end(), std::initializer_list<PatchBuilder::Token> {
+                    { PatchBuilder::TokenType::Operand, dest_register },
+                            { PatchBuilder::TokenType::Operand, stack_register },
                         { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
                         { PatchBuilder::TokenType::Operand, 0 }, // Flags
                         { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                        { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_CONST },
-                    { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
+                        { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_REG },
+                    { PatchBuilder::TokenType::Operand, static_cast<size_t>(dest_register_value_after.value - stack_register_value_after.value) },
+                    { PatchBuilder::TokenType::Operand, 1 }, // Operand Count
                     { PatchBuilder::TokenType::Operand, 0 }, // Flags
                     { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                    { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_ADD },
+                    { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_CONST },
                 { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
                 { PatchBuilder::TokenType::Operand, 0 }, // Flags
                 { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
-                { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_SET_REG },
-            });
-
-            if (!patches.empty())
-            {
-                PatchBuilder::AddPatch(*view, insn.address, PatchBuilder::Patch{
-                    view->GetInstructionLength(insn.function->GetArchitecture(), insn.address), patches
-                });
+                { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_ADD },
+            { PatchBuilder::TokenType::Operand, 2 }, // Operand Count
+            { PatchBuilder::TokenType::Operand, 0 }, // Flags
+            { PatchBuilder::TokenType::Operand, address_size }, // Operand Size
+            { PatchBuilder::TokenType::Instruction, BNLowLevelILOperation::LLIL_SET_REG },
+        });
+
+        if (!patches.empty())
+        {
+            state.AddPatch(view, pop.Block, insn.address,
+                view->GetInstructionLength(insn.function->GetArchitecture(), insn.address), patches);
 
-                total += 1;
-            }
+            total += 1;
         }
     }
 
-    return total;
+    return { visited, total };
 }
 
-size_t FixJumps(BinaryView* view, Function* func)
+PassResult FixJumps(BinaryView* view, Function* func, PassState& state)
 {
     size_t total = 0;
+    size_t visited = 0;
 
-    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+    const FunctionSummary& summary = state.GetSummary();
+    Ref<LowLevelILFunction> llil = state.GetLLIL();
 
     const uint32_t stack_register = llil->GetArchitecture()->GetStackPointerRegister();
     const size_t address_size = view->GetAddressSize();
 
-    for (Ref<BasicBlock> block : llil->GetBasicBlocks())
+    for (size_t block_index = 0; block_index < summary.Blocks.size(); ++block_index)
     {
-        LowLevelILInstruction last = llil->GetInstruction(block->GetEnd() - 1);
+        const FunctionSummary::Block& block = summary.Blocks[block_index];
 
-        if ((last.operation == LLIL_RET) ||
-            (last.operation == LLIL_JUMP) ||
-            (last.operation == LLIL_JUMP_TO) ||
-            (last.operation == LLIL_TAILCALL))
+        if (!state.IsPending(block_index))
         {
-            if (PatchBuilder::GetPatch(*llil, last.address))
+            continue;
+        }
+
+        ++visited;
+
+        if ((block.Operation == LLIL_RET) ||
+            (block.Operation == LLIL_JUMP) ||
+            (block.Operation == LLIL_JUMP_TO) ||
+            (block.Operation == LLIL_TAILCALL))
+        {
+            if (block.StackRegisterValue.state != StackFrameOffset)
             {
                 continue;
             }
 
-            RegisterValue stack_register_value = last.GetRegisterValue(stack_register);
-
-            if (stack_register_value.state != StackFrameOffset)
+            if (PatchBuilder::GetPatch(*llil, block.Address))
             {
                 continue;
             }
 
-            int64_t stack_offset = stack_register_value.value;
+            LowLevelILInstruction last = llil->GetInstruction(block.Exit);
+
+            int64_t stack_offset = block.StackRegisterValue.value;
 
             std::vector<PatchBuilder::Token> patches;
 
@@ -416,21 +837,21 @@ size_t FixJumps(BinaryView* view, Function* func)
 
             if (!patches.empty())
             {
-                PatchBuilder::AddPatch(*view, last.address, PatchBuilder::Patch {
-                    view->GetInstructionLength(last.function->GetArchitecture(), last.address), patches
-                });
+                state.AddPatch(view, block_index, last.address,
+                    view->GetInstructionLength(last.function->GetArchitecture(), last.address), patches);
 
                 total += 1;
             }
         }
     }
 
-    return total;
+    return { visited, total };
 }
 
-void LabelIndirectBranches(
+PassResult LabelIndirectBranches(
     BinaryView* view,
-    Function* func)
+    Function* func,
+    PassState& state)
 {
     Ref<MediumLevelILFunction> mlil_ssa = func->GetMediumLevelIL()->GetSSAForm();
     Ref<Architecture> arch = func->GetArchitecture();
@@ -440,8 +861,12 @@ void LabelIndirectBranches(
     MediumLevelILInstruction true_val;
     MediumLevelILInstruction false_val;
 
+    size_t visited = 0;
+
     for (Ref<BasicBlock>& block : mlil_ssa->GetBasicBlocks())
     {
+        ++visited;
+
         MediumLevelILInstruction last = mlil_ssa->GetInstruction(block->GetEnd() - 1);
 
         if (MLIL_SSA_GetIndirectBranchCondition(last, branch, condition, true_val, false_val))
@@ -472,21 +897,19 @@ void LabelIndirectBranches(
             }
         }
     }
+
+    return { visited, 0 };
 }
 
-void LabelPossibleTails(BinaryView* view, Function* func)
+PassResult LabelPossibleTails(BinaryView* view, Function* func, PassState& state)
 {
     Ref<Architecture> arch = func->GetArchitecture();
-    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
 
-    const uint32_t stack_register = arch->GetStackPointerRegister();
-    const size_t address_size = view->GetAddressSize();
+    const FunctionSummary& summary = state.GetSummary();
 
-    for (Ref<BasicBlock> block : llil->GetBasicBlocks())
+    for (const FunctionSummary::Block& block : summary.Blocks)
     {
-        LowLevelILInstruction last = llil->GetInstruction(block->GetEnd() - 1);
-
-        RegisterValue stack_register_value = last.GetRegisterValue(stack_register);
+        const RegisterValue& stack_register_value = block.StackRegisterValue;
 
         if (stack_register_value.state != StackFrameOffset)
         {
@@ -495,15 +918,17 @@ void LabelPossibleTails(BinaryView* view, Function* func)
 
         if (stack_register_value.value == 0)
         {
-            if (func->GetInstructionHighlight(arch, last.address).alpha == 0)
+            if (func->GetInstructionHighlight(arch, block.Address).alpha == 0)
             {
-                func->SetUserInstructionHighlight(arch, last.address, MagentaHighlightColor);
+                func->SetUserInstructionHighlight(arch, block.Address, MagentaHighlightColor);
             }
         }
     }
+
+    return { summary.Blocks.size(), 0 };
 }
 
-void LabelNonLinearCalls(BinaryView* view, Function* func)
+PassResult LabelNonLinearCalls(BinaryView* view, Function* func, PassState& state)
 {
     Ref<Architecture> arch = func->GetArchitecture();
     Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
@@ -511,8 +936,12 @@ void LabelNonLinearCalls(BinaryView* view, Function* func)
     const uint64_t lower_limit = func->GetStart();
     const uint64_t upper_limit = lower_limit + (llil->GetInstructionCount() * 5);
 
+    size_t visited = 0;
+
     for (Ref<BasicBlock> block : llil->GetBasicBlocks())
     {
+        ++visited;
+
         for (size_t i = block->GetStart(); i < block->GetEnd(); ++i)
         {
             LowLevelILInstruction insn = llil->GetInstruction(i);
@@ -534,15 +963,181 @@ void LabelNonLinearCalls(BinaryView* view, Function* func)
             }
         }
     }
+
+    return { visited, 0 };
+}
+
+void RegisterObfuPasses()
+{
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("fixTails", "Remove Tail Functions",
+        "Merge functions which are only reached by jumping to them back into their caller",
+        ObfuPass::Stage::Fix, 100, true, &FixTails));
+
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("fixJumps", "Resolve Stack Jumps",
+        "Replace jumps and returns through constants pushed onto the stack with direct jumps and calls",
+        ObfuPass::Stage::Fix, 200, true, &FixJumps));
+
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("fixStack", "Simplify Stack Pops",
+        "Replace pops into registers which end up pointing at the stack with stack pointer arithmetic",
+        ObfuPass::Stage::Fix, 300, true, &FixStack));
+
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("labelIndirectBranches", "Label Indirect Branches",
+        "Comment and highlight indirect branches which choose between two constants",
+        ObfuPass::Stage::Label, 100, true, &LabelIndirectBranches));
+
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("labelPossibleTails", "Label Possible Tails",
+        "Highlight block exits where the stack is back at its starting offset",
+        ObfuPass::Stage::Label, 200, true, &LabelPossibleTails));
+
+    ObfuPassRegistry::Register(std::make_unique<ObfuPass>("labelNonLinearCalls", "Label Non-Linear Calls",
+        "Highlight calls made from far outside the function's expected range",
+        ObfuPass::Stage::Label, 300, true, &LabelNonLinearCalls));
+}
+
+// Runs every enabled fixer, so one finding something doesn't push the others back a whole reanalysis
+StopReason FixObfuscationPass(
+    BinaryView* view,
+    Function* func,
+    BlockWorklist& worklist,
+    ConvergenceTracker& tracker)
+{
+    const ConvergenceTracker::Clock::time_point start = ConvergenceTracker::Clock::now();
+
+    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+
+    std::shared_ptr<const FunctionSummary> summary = GetFunctionSummary(func, llil);
+
+    StopReason reason = tracker.Observe(summary->Fingerprint);
+
+    if (reason != StopReason::None)
+    {
+        return reason;
+    }
+
+    PassState state(llil, summary, worklist);
+
+    size_t total = 0;
+
+    for (ObfuPass* pass : ObfuPassRegistry::GetPasses(ObfuPass::Stage::Fix, view))
+    {
+        total += pass->Run(view, func, state).Patches;
+    }
+
+    state.Settle(worklist);
+
+    for (const auto& patch : state.GetEmitted())
+    {
+        tracker.Emit(patch.first, patch.second);
+    }
+
+    tracker.Charge(ConvergenceTracker::Clock::now() - start);
+
+    return tracker.Record(total);
 }
 
-bool FixObfuscationPass(
+void LabelFunction(
     BinaryView* view,
     Function* func)
 {
-    return FixTails(view, func)
-        || FixJumps(view, func)
-        || FixStack(view, func);
+    Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+
+    BlockWorklist worklist;
+    PassState state(llil, GetFunctionSummary(func, llil), worklist);
+
+    for (ObfuPass* pass : ObfuPassRegistry::GetPasses(ObfuPass::Stage::Label, view))
+    {
+        pass->Run(view, func, state);
+    }
+}
+
+// Returns false if the task was cancelled
+bool DeobfuscateFunction(
+    BackgroundTask* task,
+    BinaryView* view,
+    Function* func,
+    AnalysisUpdateNotification& analysis)
+{
+    std::string func_name = func->GetSymbol()->GetShortName();
+
+    TraceSpan span("function", "Deobfuscate");
+    span.SetArg("function", func_name);
+
+    AdvancedFunctionAnalysisDataRequestor priority(func);
+
+    BlockWorklist worklist;
+    ConvergenceTracker tracker;
+
+    while (tracker.GetReason() == StopReason::None)
+    {
+        const size_t pass = tracker.GetPasses() + 1;
+
+        TraceSpan pass_span("pass", "Pass");
+
+        if (pass_span.IsRecording())
+        {
+            pass_span.SetArg("pass", std::to_string(pass));
+        }
+
+        if (task)
+        {
+            if (task->IsCancelled())
+            {
+                tracker.Stop(StopReason::Cancelled);
+
+                break;
+            }
+
+            task->SetProgressText(fmt::format("Deobfuscating {0}, Pass {1} Pending", func_name, pass));
+        }
+
+        const ConvergenceTracker::Clock::time_point update_start = ConvergenceTracker::Clock::now();
+
+        {
+            TraceSpan update_span("analysis", "UpdateAnalysis");
+
+            FunctionSummaries.Evict(func->m_object);
+            func->Reanalyze();
+            view->UpdateAnalysis();
+        }
+
+        {
+            TraceSpan wait_span("analysis", "WaitForAnalysis");
+
+            analysis.Wait(func);
+        }
+
+        tracker.Charge(ConvergenceTracker::Clock::now() - update_start);
+
+        if (task)
+        {
+            task->SetProgressText(fmt::format("Deobfuscating {0}, Pass {1} Analyzing", func_name, pass));
+        }
+
+        FixObfuscationPass(view, func, worklist, tracker);
+    }
+
+    if (tracker.GetReason() == StopReason::Cancelled)
+    {
+        FunctionSummaries.Evict(func->m_object);
+
+        BinjaLog(InfoLog, "Stopped deobfuscating {0} after {1} passes, {2}", func_name, tracker.GetPasses(), tracker.Describe());
+
+        return false;
+    }
+
+    if (task)
+    {
+        task->SetProgressText(fmt::format("Deobfuscating {0}, Post-Analysis", func_name));
+    }
+
+    LabelFunction(view, func);
+
+    // Nothing will look at the summary again, so don't hold it until it's evicted from the budget
+    FunctionSummaries.Evict(func->m_object);
+
+    BinjaLog(InfoLog, "Deobfuscated {0} after {1} passes, {2}", func_name, tracker.GetPasses(), tracker.Describe());
+
+    return true;
 }
 
 void FixObfuscation(
@@ -551,62 +1146,191 @@ void FixObfuscation(
     Ref<Function> func,
     bool auto_save)
 {
-    size_t passes = 1;
+    SummaryUpdateNotification analysis(view);
 
-    std::string func_name = func->GetSymbol()->GetShortName();
+    if (!DeobfuscateFunction(task, view, func, analysis))
+    {
+        return;
+    }
 
-    AdvancedFunctionAnalysisDataRequestor priority(func);
+    if (auto_save)
+    {
+        PatchBuilder::SavePatches(*view);
+    }
+}
+
+void FixObfuscationBatch(
+    Ref<BackgroundTask> task,
+    Ref<BinaryView> view,
+    std::vector<Ref<Function>> funcs,
+    bool auto_save)
+{
+    TraceSpan span("batch", "DeobfuscateBatch");
+
+    if (span.IsRecording())
+    {
+        span.SetArg("functions", std::to_string(funcs.size()));
+    }
+
+    SummaryUpdateNotification analysis(view);
+
+    std::vector<AdvancedFunctionAnalysisDataRequestor> priorities;
+    priorities.reserve(funcs.size());
+
+    for (const Ref<Function>& func : funcs)
+    {
+        priorities.emplace_back(func);
+    }
+
+    WorkStealingPool pool(std::min(WorkStealingPool::GetDefaultThreadCount(), std::max<size_t>(funcs.size(), 1)));
 
-    // Ref<LowLevelILFunction> llil = func->GetLowLevelIL();
+    // Every function still being patched goes through each round together, so the core only has to
+    // update analysis once per round rather than once per function per pass
+    std::vector<size_t> active(funcs.size());
 
-    for (; passes < 100; ++passes)
+    for (size_t i = 0; i < funcs.size(); ++i)
+    {
+        active[i] = i;
+    }
+
+    std::vector<BlockWorklist> worklists(funcs.size());
+    std::vector<ConvergenceTracker> trackers(funcs.size());
+
+    size_t rounds = 1;
+
+    for (; !active.empty(); ++rounds)
     {
         if (task)
         {
             if (task->IsCancelled())
             {
-                return;
+                break;
             }
 
-            task->SetProgressText(fmt::format("Deobfuscating {0}, Pass {1} Pending", func_name, passes));
+            task->SetProgressText(fmt::format("Deobfuscating, Round {0}, {1}/{2} Functions Pending", rounds, active.size(), funcs.size()));
         }
 
-        func->Reanalyze();
-        view->UpdateAnalysis();
+        TraceSpan round_span("pass", "Round");
 
-        while (func->NeedsUpdate())
+        if (round_span.IsRecording())
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            round_span.SetArg("round", std::to_string(rounds));
+            round_span.SetArg("functions", std::to_string(active.size()));
+        }
+
+        const ConvergenceTracker::Clock::time_point update_start = ConvergenceTracker::Clock::now();
+
+        {
+            TraceSpan update_span("analysis", "UpdateAnalysis");
+
+            for (size_t i : active)
+            {
+                FunctionSummaries.Evict(funcs[i]->m_object);
+                funcs[i]->Reanalyze();
+            }
+
+            view->UpdateAnalysis();
+        }
+
+        {
+            TraceSpan wait_span("analysis", "WaitForAnalysis");
+
+            for (size_t i : active)
+            {
+                analysis.Wait(funcs[i]);
+            }
+        }
+
+        // The round's reanalysis is shared, so each function is charged an equal part of it
+        const ConvergenceTracker::Clock::duration update_share = (ConvergenceTracker::Clock::now() - update_start) / active.size();
+
+        for (size_t i : active)
+        {
+            trackers[i].Charge(update_share);
         }
 
         if (task)
         {
-            task->SetProgressText(fmt::format("Deobfuscating {0}, Pass {1} Analyzing", func_name, passes));
+            task->SetProgressText(fmt::format("Deobfuscating, Round {0}, {1}/{2} Functions Analyzing", rounds, active.size(), funcs.size()));
+        }
+
+        std::vector<size_t> patched;
+        std::mutex patched_mutex;
+
+        for (size_t i : active)
+        {
+            pool.Submit([&, i]
+            {
+                TraceSpan fix_span("function", "Fix");
+
+                if (fix_span.IsRecording())
+                {
+                    fix_span.SetArg("function", funcs[i]->GetSymbol()->GetShortName());
+                }
+
+                if (FixObfuscationPass(view, funcs[i], worklists[i], trackers[i]) == StopReason::None)
+                {
+                    std::lock_guard<std::mutex> guard(patched_mutex);
+
+                    patched.push_back(i);
+                }
+                else
+                {
+                    BinjaLog(InfoLog, "Deobfuscated {0} after {1} passes, {2}",
+                        funcs[i]->GetSymbol()->GetShortName(), trackers[i].GetPasses(), trackers[i].Describe());
+                }
+            });
         }
 
-        if (FixObfuscationPass(view, func))
+        pool.Wait();
+
+        active = std::move(patched);
+    }
+
+    const bool cancelled = task && task->IsCancelled();
+
+    if (!cancelled)
+    {
+        if (task)
         {
-            // Beep Boop
+            task->SetProgressText(fmt::format("Deobfuscating, Post-Analysis, {0} Functions", funcs.size()));
         }
-        else
+
+        for (const Ref<Function>& func : funcs)
         {
-            break;
+            pool.Submit([&, func]
+            {
+                TraceSpan label_span("function", "Label");
+
+                if (label_span.IsRecording())
+                {
+                    label_span.SetArg("function", func->GetSymbol()->GetShortName());
+                }
+
+                LabelFunction(view, func);
+            });
         }
+
+        pool.Wait();
     }
 
-    if (task)
+    for (const Ref<Function>& func : funcs)
     {
-        task->SetProgressText(fmt::format("Deobfuscating {0}, Post-Analysis", func_name));
+        FunctionSummaries.Evict(func->m_object);
     }
 
-    LabelIndirectBranches(view, func);
-    LabelPossibleTails(view, func);
-    LabelNonLinearCalls(view, func);
+    if (cancelled)
+    {
+        BinjaLog(InfoLog, "Stopped deobfuscating after {0} rounds, {1}/{2} functions unfinished", rounds - 1, active.size(), funcs.size());
+
+        return;
+    }
 
+    // Save once for the whole batch, rather than once per function
     if (auto_save)
     {
         PatchBuilder::SavePatches(*view);
     }
 
-    BinjaLog(InfoLog, "Deobfuscated {0} after {1} passes", func_name, passes);
+    BinjaLog(InfoLog, "Deobfuscated {0} functions after {1} rounds", funcs.size(), rounds - 1);
 }
@@ -33,6 +33,9 @@ void ObjectDestructionNotification::DestructFunctionCallback(void* ctxt, BNFunct
 ObjectDestructionNotification::ObjectDestructionNotification()
 {
     m_callbacks.context = this;
+    m_callbacks.destructBinaryView = DestructBinaryViewCallback;
+    m_callbacks.destructFileMetadata = DestructFileMetadataCallback;
+    m_callbacks.destructFunction = DestructFunctionCallback;
 
     BNRegisterObjectDestructionCallbacks(&m_callbacks);
 }
@@ -0,0 +1,110 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "PatchArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace PatchBuilder
+{
+    PatchArena::PatchBlock::~PatchBlock()
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            reinterpret_cast<Patch*>(&Patches[i])->~Patch();
+        }
+    }
+
+    uint8_t* PatchArena::AllocateBytes(size_t size, size_t align)
+    {
+        const size_t padding = (align - (reinterpret_cast<uintptr_t>(m_Bytes) & (align - 1))) & (align - 1);
+
+        if (size + padding > m_BytesLeft)
+        {
+            // New blocks are aligned for any type
+            const size_t block_size = std::max(size, size_t(BytesPerBlock));
+
+            m_ByteBlocks.emplace_back(new uint8_t[block_size]);
+
+            m_Bytes = m_ByteBlocks.back().get();
+            m_BytesLeft = block_size;
+            m_Reserved += block_size;
+        }
+        else
+        {
+            m_Bytes += padding;
+            m_BytesLeft -= padding;
+        }
+
+        uint8_t* result = m_Bytes;
+
+        m_Bytes += size;
+        m_BytesLeft -= size;
+        m_Used += size;
+
+        return result;
+    }
+
+    const Patch* PatchArena::Store(Patch patch)
+    {
+        if (m_PatchBlocks.empty() || (m_PatchBlocks.back()->Count == PatchesPerBlock))
+        {
+            m_PatchBlocks.emplace_back(new PatchBlock());
+            m_Reserved += sizeof(PatchBlock);
+        }
+
+        PatchBlock& block = *m_PatchBlocks.back();
+
+        Patch* result = new (&block.Patches[block.Count]) Patch(std::move(patch));
+
+        ++block.Count;
+        m_Used += sizeof(Patch);
+
+        if (result->OwnedParams)
+        {
+            uint8_t* params = AllocateBytes(result->ParamSize);
+
+            std::memcpy(params, result->Params, result->ParamSize);
+
+            result->Params = params;
+            result->OwnedParams.reset();
+        }
+
+        if (result->OwnedValues)
+        {
+            const size_t size = result->Template->Slots.size() * sizeof(size_t);
+
+            size_t* values = reinterpret_cast<size_t*>(AllocateBytes(size, alignof(size_t)));
+
+            std::memcpy(values, result->Values, size);
+
+            result->Values = values;
+            result->OwnedValues.reset();
+        }
+
+        return result;
+    }
+
+    size_t PatchArena::GetReserved() const
+    {
+        return m_Reserved;
+    }
+
+    size_t PatchArena::GetUsed() const
+    {
+        return m_Used;
+    }
+}
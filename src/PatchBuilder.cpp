@@ -14,64 +14,256 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "PatchBuilder.h"
-#include "BinaryViewAssociatedDataStore.h"
+#include "PatchCollection.h"
+#include "PatchDatabase.h"
+#include "EpochReclaimer.h"
+#include "FileAssociatedDataStore.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
-#include "DataBufferAdapter.h"
+namespace PatchBuilder
+{
+    class PatchCollectionStore
+        : public FileAssociatedDataStore<PatchCollection>
+    {
+    protected:
+        std::atomic<uint64_t> m_Epoch {0};
 
-#include <unordered_map>
-#include <mutex>
+        void DestructBinaryView(BNBinaryView* view) override
+        {
+            m_Epoch.fetch_add(1, std::memory_order_acq_rel);
 
-#include <bitsery/bitsery.h>
-#include <bitsery/traits/vector.h>
-#include <bitsery/flexible.h>
-#include <bitsery/flexible/unordered_map.h>
+            FileAssociatedDataStore<PatchCollection>::DestructBinaryView(view);
+        }
 
-static const std::string PATCH_METADATA_KEY = "OBFU_PATCHES";
-static const std::string PATCH_METADATA_VERSION = "0.0.0";
+        void DestructFileMetadata(BNFileMetadata* file) override
+        {
+            m_Epoch.fetch_add(1, std::memory_order_acq_rel);
 
-namespace PatchBuilder
-{
-    struct PatchCollection
+            FileAssociatedDataStore<PatchCollection>::DestructFileMetadata(file);
+        }
+
+        void DestructFunction(BNFunction* func) override
+        {
+            m_Epoch.fetch_add(1, std::memory_order_acq_rel);
+
+            FileAssociatedDataStore<PatchCollection>::DestructFunction(func);
+        }
+
+    public:
+        // Changes whenever a function, view or collection is freed, and with it any IL function a cache may point to
+        uint64_t GetEpoch() const
+        {
+            return m_Epoch.load(std::memory_order_acquire);
+        }
+    };
+
+    struct PatchTemplateHash
+    {
+        size_t operator()(const PatchTemplate* tmpl) const
+        {
+            uint64_t hash = 0xCBF29CE484222325ULL;
+
+            for (uint8_t byte : tmpl->Code)
+            {
+                hash = (hash ^ byte) * 0x100000001B3ULL;
+            }
+
+            for (uint32_t slot : tmpl->Slots)
+            {
+                hash = (hash ^ slot) * 0x100000001B3ULL;
+            }
+
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct PatchTemplateEqual
+    {
+        bool operator()(const PatchTemplate* lhs, const PatchTemplate* rhs) const
+        {
+            return *lhs == *rhs;
+        }
+    };
+
+    // Keyed by the pooled templates themselves, which remove their entry when released.
+    // Declared before the store, as freeing the store's collections releases templates.
+    std::unordered_map<const PatchTemplate*, std::weak_ptr<const PatchTemplate>, PatchTemplateHash, PatchTemplateEqual> TemplatePool;
+    std::mutex TemplatePoolMutex;
+
+    void ReleaseTemplate(const PatchTemplate* tmpl)
+    {
+        {
+            std::lock_guard<std::mutex> guard(TemplatePoolMutex);
+
+            auto iter = TemplatePool.find(tmpl);
+
+            // An equal template may have replaced this one while it was being released
+            if ((iter != TemplatePool.end()) && (iter->first == tmpl))
+            {
+                TemplatePool.erase(iter);
+            }
+        }
+
+        delete tmpl;
+    }
+
+    PatchCollectionStore PatchStore;
+
+    // Initial loads run here rather than on their own threads. Created with the first collection, and only ever
+    // destroyed by ShutdownPatches, so no static destructor joins its threads at unload.
+    WorkStealingPool* LoadPool = nullptr;
+    std::mutex LoadPoolMutex;
+
+    WorkStealingPool& GetLoadPool()
     {
-        std::unordered_map<uintptr_t, Patch> m_Patches;
-        mutable std::mutex m_Mutex;
+        std::lock_guard<std::mutex> guard(LoadPoolMutex);
 
-        void AddPatch(uintptr_t address, Patch patch);
-        const Patch* GetPatch(uintptr_t address) const;
+        if (LoadPool == nullptr)
+        {
+            LoadPool = new WorkStealingPool(std::min<size_t>(WorkStealingPool::GetDefaultThreadCount(), 2));
+        }
 
-        void Save(BinaryView& view);
-        void Load(BinaryView& view);
+        return *LoadPool;
+    }
+
+    // The function owning the last IL this thread lifted, and the collection it resolved to.
+    // Nothing is referenced, so the entry is only trusted until the store's epoch changes. It's keyed on the function
+    // rather than its IL, since IL is freed and reallocated by reanalysis without any destruction callback.
+    struct PatchCollectionCache
+    {
+        BNFunction* Function = nullptr;
+        PatchCollection* Patches = nullptr;
+        uint64_t Epoch = 0;
     };
 
-    BinaryViewAssociatedDataStore<PatchCollection> PatchStore;
+    thread_local PatchCollectionCache CachedPatches;
+
+    // Patches are saved in the analysis view's metadata. Commands can still be run on the Raw view, so use the
+    // file's analysis view instead whenever it has one.
+    Ref<BinaryView> GetAnalysisView(BNBinaryView* view)
+    {
+        char* type = BNGetViewType(view);
+        const bool raw = std::strcmp(type, "Raw") == 0;
+        BNFreeString(type);
+
+        if (raw)
+        {
+            BNFileMetadata* file = BNGetFileForView(view);
+
+            size_t count = 0;
+            char** types = BNGetExistingViews(file, &count);
+
+            BNBinaryView* analysis = nullptr;
+
+            for (size_t i = 0; (i < count) && (analysis == nullptr); ++i)
+            {
+                if (std::strcmp(types[i], "Raw") != 0)
+                {
+                    analysis = BNGetFileViewOfType(file, types[i]);
+                }
+            }
+
+            BNFreeStringList(types, count);
+            BNFreeFileMetadata(file);
+
+            if (analysis != nullptr)
+            {
+                return new BinaryView(analysis);
+            }
+        }
+
+        return new BinaryView(BNNewViewReference(view));
+    }
 
-    PatchCollection* GetPatchCollection(BNBinaryView* view)
+    // Patches are shared by every view of a file, and loaded from its analysis view
+    PatchCollection* GetPatchCollection(BNBinaryView* view, bool wait = true)
     {
-        if (PatchCollection* patches = PatchStore.Get(view))
+        // The view keeps its file alive, so the pointer stays valid after releasing this reference
+        BNFileMetadata* file = BNGetFileForView(view);
+        BNFreeFileMetadata(file);
+
+        PatchCollection* patches = PatchStore.GetOrCreate(file, [view]
         {
-            return patches;
+            std::unique_ptr<PatchCollection> created(new PatchCollection());
+
+            created->LoadAsync(GetLoadPool(), GetAnalysisView(view));
+
+            return created;
+        });
+
+        if (wait)
+        {
+            patches->WaitForLoad();
         }
 
-        std::unique_ptr<PatchCollection> patches(new PatchCollection());
+        return patches;
+    }
 
-        Ref<BinaryView> ref_view = new BinaryView(view);
+    void ShutdownPatches()
+    {
+        WorkStealingPool* pool = nullptr;
 
-        patches->Load(*ref_view);
+        {
+            std::lock_guard<std::mutex> guard(LoadPoolMutex);
+
+            std::swap(pool, LoadPool);
+        }
 
-        PatchStore.Set(view, std::move(patches));
+        if (pool)
+        {
+            // Loads which haven't started are dropped, then the destructor waits for the rest
+            pool->Cancel();
 
-        return PatchStore.Get(view);
+            delete pool;
+        }
     }
 
     void AddPatch(BinaryView& view, uintptr_t address, Patch patch)
     {
+        if (!patch.Verify())
+        {
+            BinjaLog(ErrorLog, "Rejected invalid patch @ 0x{0:x}", address);
+
+            return;
+        }
+
         PatchCollection* patches = GetPatchCollection(view.m_object);
 
         patches->AddPatch(address, std::move(patch));
     }
 
+    PatchCollection* FindPatchCollection(BNFunction* function)
+    {
+        BNBinaryView* view = BNGetFunctionData(function);
+
+        if (view == nullptr)
+        {
+            return nullptr;
+        }
+
+        PatchCollection* patches = GetPatchCollection(view);
+        BNFreeBinaryView(view);
+
+        return patches;
+    }
+
     const Patch* GetPatch(LowLevelILFunction& il, uintptr_t address)
     {
+        PatchCollectionCache& cache = CachedPatches;
+
+        // Read before the owner, so a function destroyed after this is never trusted
+        const uint64_t epoch = PatchStore.GetEpoch();
+
+        // The IL keeps its function alive, so the pointer stays valid after releasing this reference
         BNFunction* function = BNGetLowLevelILOwnerFunction(il.m_object);
 
         if (function == nullptr)
@@ -79,207 +271,703 @@ namespace PatchBuilder
             return nullptr;
         }
 
-        BNBinaryView* view = BNGetFunctionData(function);
         BNFreeFunction(function);
 
-        if (view == nullptr)
+        if ((cache.Function != function) || (cache.Epoch != epoch))
+        {
+            cache.Patches = FindPatchCollection(function);
+            cache.Function = function;
+            cache.Epoch = epoch;
+        }
+
+        if (cache.Patches == nullptr)
         {
             return nullptr;
         }
 
-        const PatchCollection* patches = GetPatchCollection(view);
-        BNFreeBinaryView(view);
+        return cache.Patches->GetPatch(address);
+    }
 
-        if (patches == nullptr)
+    void PreloadPatches(BinaryView& view)
+    {
+        // The raw view is finalized first, but patches are saved in the analysis view
+        if (view.GetTypeName() == "Raw")
         {
-            return nullptr;
+            return;
         }
 
-        return patches->GetPatch(address);
+        GetPatchCollection(view.m_object, false);
     }
 
     void LoadPatches(BinaryView & view)
     {
         PatchCollection* patches = GetPatchCollection(view.m_object);
 
-        patches->Load(view);
+        patches->Load(*GetAnalysisView(view.m_object));
     }
 
     void SavePatches(BinaryView & view)
     {
+        TraceSpan span("patches", "SavePatches");
+
         PatchCollection* patches = GetPatchCollection(view.m_object);
 
-        patches->Save(view);
+        patches->Save(*GetAnalysisView(view.m_object));
     }
 
-    void PatchCollection::AddPatch(uintptr_t address, Patch patch)
+    bool ExportPatches(BinaryView& view, const std::string& path)
     {
-        std::lock_guard<std::mutex> guard(m_Mutex);
+        PatchCollection* patches = GetPatchCollection(view.m_object);
 
-        m_Patches.emplace(address, std::move(patch));
+        return patches->Export(path);
     }
 
-    const Patch* PatchCollection::GetPatch(uintptr_t address) const
+    bool ImportPatches(BinaryView& view, const std::string& path)
     {
-        std::lock_guard<std::mutex> guard(m_Mutex);
+        std::shared_ptr<const PatchDatabase> database = PatchDatabase::Open(path);
 
-        auto find = m_Patches.find(address);
-
-        if (find != m_Patches.end())
+        if (!database)
         {
-            return &find->second;
+            return false;
         }
 
-        return nullptr;
+        PatchCollection* patches = GetPatchCollection(view.m_object);
+
+        patches->Import(database);
+
+        BinjaLog(InfoLog, "Imported {0} patches from {1}, each decoded on first use", database->GetPatchCount(), path);
+
+        return true;
+    }
+
+    void BenchmarkCodecs(BinaryView& view)
+    {
+        PatchCollection* patches = GetPatchCollection(view.m_object);
+
+        patches->BenchmarkCodecs();
     }
 
-    void PatchCollection::Save(BinaryView& view)
+    void BenchmarkLifting(BinaryView& view)
     {
-        DataBuffer db;
+        static const size_t MaxTargets = 0x10000;
+        static const size_t Iterations = 4;
+
+        PatchCollection* patches = GetPatchCollection(view.m_object);
+
+        // Patches are lifted into scratch IL owned by the function containing them, so lookups resolve as they would when analyzing
+        std::vector<std::pair<uintptr_t, Ref<Function>>> targets;
 
-        if (bitsery::quickSerialization<OutputDataBufferAdapater>(db, m_Patches))
         {
-            if (db.ZlibCompress(db))
+            EpochReclaimer::Guard epoch;
+
+            for (const PatchEntryRef& entry : patches->GetPatches(0, std::numeric_limits<uintptr_t>::max()))
             {
-                std::vector<uint8_t> raw(
-                    static_cast<const uint8_t*>(db.GetData()),
-                    static_cast<const uint8_t*>(db.GetData()) + db.GetLength()
-                );
-
-                Ref<Metadata> patches = new Metadata
-                ({
-                    { "version", new Metadata(PATCH_METADATA_VERSION) },
-                    { "data", new Metadata(raw) }
+                std::vector<Ref<Function>> funcs = view.GetAnalysisFunctionsContainingAddress(entry.Address);
+
+                if (!funcs.empty())
+                {
+                    targets.emplace_back(entry.Address, funcs.front());
+                }
+
+                if (targets.size() == MaxTargets)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (targets.empty())
+        {
+            BinjaLog(WarningLog, "No patches inside functions to benchmark");
+
+            return;
+        }
+
+        using clock = std::chrono::steady_clock;
+
+        const size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        BinjaLog(InfoLog, "Benchmarking lifting of {0} patches on 1 to {1} threads", targets.size(), max_threads);
+
+        for (size_t thread_count = 1;; thread_count = std::min(thread_count * 2, max_threads))
+        {
+            std::atomic<size_t> failures {0};
+            std::vector<std::thread> threads;
+
+            clock::time_point start = clock::now();
+
+            // Every thread lifts every patch, so they all contend on the same collection
+            for (size_t i = 0; i < thread_count; ++i)
+            {
+                threads.emplace_back([&targets, &failures]
+                {
+                    size_t failed = 0;
+
+                    for (size_t j = 0; j < Iterations; ++j)
+                    {
+                        Ref<LowLevelILFunction> il;
+                        Ref<Architecture> arch;
+                        Function* owner = nullptr;
+
+                        for (const auto& target : targets)
+                        {
+                            if (target.second.GetPtr() != owner)
+                            {
+                                owner = target.second;
+                                arch = owner->GetArchitecture();
+                                il = new LowLevelILFunction(arch, owner);
+                            }
+
+                            il->SetCurrentAddress(arch, target.first);
+
+                            EpochReclaimer::Guard epoch;
+
+                            const Patch* patch = GetPatch(*il, target.first);
+
+                            if (!patch || !patch->Evaluate(*il))
+                            {
+                                ++failed;
+                            }
+                        }
+                    }
+
+                    failures.fetch_add(failed, std::memory_order_relaxed);
                 });
+            }
 
-                view.StoreMetadata(PATCH_METADATA_KEY, patches);
+            for (std::thread& thread : threads)
+            {
+                thread.join();
             }
-            else
+
+            const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            const double lifts = static_cast<double>(targets.size() * Iterations * thread_count);
+
+            BinjaLog(InfoLog, "{0} threads: {1:.0f} lifts in {2:.1f} ms, {3:.2f}M lifts/s ({4:.2f}M per thread), {5} failed",
+                thread_count, lifts, elapsed * 1000, lifts / elapsed / 1e6, lifts / elapsed / 1e6 / thread_count, failures.load());
+
+            if (thread_count == max_threads)
             {
-                BinjaLog(ErrorLog, "Failed to compress patch data for {0}", view.GetFile()->GetFilename());
+                break;
             }
         }
-        else
+    }
+
+    void PatchTotals::Add(const Patch& patch)
+    {
+        ++Count;
+
+        ParamBytes += patch.ParamSize;
+        TokenBytes += patch.ParamSize;
+
+        if (patch.Template)
         {
-            BinjaLog(ErrorLog, "Failed to serialize patch data for {0}", view.GetFile()->GetFilename());
+            TokenBytes += patch.Template->Code.size();
         }
     }
 
-    void PatchCollection::Load(BinaryView& view)
+    void PatchTotals::Add(const PatchTotals& totals)
+    {
+        Count += totals.Count;
+        TokenBytes += totals.TokenBytes;
+        ParamBytes += totals.ParamBytes;
+    }
+
+    PatchStatistics GetPatchStatistics(BinaryView& view)
     {
-        m_Patches.clear();
+        PatchCollection* patches = GetPatchCollection(view.m_object);
+
+        return patches->GetStatistics();
+    }
+
+    void EncodeToken(std::vector<uint8_t>& output, const Token& token)
+    {
+        uint64_t value = static_cast<uint64_t>(token.Value);
+
+        value = (value << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
 
-        Ref<Metadata> patches = view.QueryMetadata(PATCH_METADATA_KEY);
+        uint8_t byte = static_cast<uint8_t>(value & 0x3F);
 
-        if (patches && patches->IsKeyValueStore())
+        if (token.Type == TokenType::Instruction)
         {
-            std::map<std::string, Ref<Metadata>> data = patches->GetKeyValueStore();
+            byte |= 0x40;
+        }
+
+        value >>= 6;
+
+        while (value)
+        {
+            output.push_back(byte | 0x80);
+
+            byte = static_cast<uint8_t>(value & 0x7F);
+            value >>= 7;
+        }
+
+        output.push_back(byte);
+    }
+
+    bool DecodeToken(const uint8_t*& data, const uint8_t* end, Token& token)
+    {
+        if (data == end)
+        {
+            return false;
+        }
 
-            if (data.at("version")->GetString() == PATCH_METADATA_VERSION)
+        uint8_t byte = *data++;
+
+        token.Type = (byte & 0x40) ? TokenType::Instruction : TokenType::Operand;
+
+        uint64_t value = byte & 0x3F;
+
+        for (unsigned shift = 6; byte & 0x80; shift += 7)
+        {
+            if ((data == end) || (shift >= 64))
             {
-                std::vector<uint8_t> raw = data.at("data")->GetRaw();
-                DataBuffer db(raw.data(), raw.size());
+                return false;
+            }
 
-                if (db.ZlibDecompress(db))
-                {
-                    if (bitsery::quickDeserialization<InputDataBufferAdapater>({ db }, m_Patches).first == bitsery::ReaderError::NoError)
-                    {
-                        BinjaLog(InfoLog, "Successfully loaded patch data for {0}", view.GetFile()->GetFilename());
-                    }
-                    else
-                    {
-                        BinjaLog(ErrorLog, "Failed to deserialize patch data for {0}", view.GetFile()->GetFilename());
-                    }
-                }
-                else
+            byte = *data++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        }
+
+        token.Value = static_cast<size_t>((value >> 1) ^ (~(value & 1) + 1));
+
+        return true;
+    }
+
+    bool PatchTemplate::operator==(const PatchTemplate& other) const
+    {
+        return (Code == other.Code) && (Slots == other.Slots);
+    }
+
+    // Decodes the template's tokens, and checks that they evaluate to whole instructions whatever values the
+    // parameters take. Parameters can't be an instruction's count, flags or size, so the structure never depends on them.
+    bool DecodeTemplate(PatchTemplate& tmpl)
+    {
+        tmpl.Tokens.clear();
+
+        if (tmpl.Code.size() > PatchTemplate::MaxCodeSize)
+        {
+            BinjaLog(ErrorLog, "Patch too large ({0} bytes)", tmpl.Code.size());
+
+            return false;
+        }
+
+        const uint8_t* code = tmpl.Code.data();
+        const uint8_t* code_end = code + tmpl.Code.size();
+
+        while (code != code_end)
+        {
+            Token token;
+
+            if (!DecodeToken(code, code_end, token))
+            {
+                BinjaLog(ErrorLog, "Truncated Token");
+
+                return false;
+            }
+
+            tmpl.Tokens.push_back(token);
+        }
+
+        tmpl.Tokens.shrink_to_fit();
+
+        std::vector<bool> slots(tmpl.Tokens.size());
+
+        for (size_t i = 0; i < tmpl.Slots.size(); ++i)
+        {
+            const uint32_t slot = tmpl.Slots[i];
+
+            if ((slot >= tmpl.Tokens.size()) || (tmpl.Tokens[slot].Type != TokenType::Operand) || ((i != 0) && (tmpl.Slots[i - 1] >= slot)))
+            {
+                BinjaLog(ErrorLog, "Bad parameter slot {0}", slot);
+
+                return false;
+            }
+
+            slots[slot] = true;
+        }
+
+        // Operands are literals, instructions are the expressions they produce
+        std::vector<TokenType> stack;
+
+        for (size_t i = 0; i < tmpl.Tokens.size(); ++i)
+        {
+            const Token& token = tmpl.Tokens[i];
+
+            if (token.Type == TokenType::Operand)
+            {
+                stack.push_back(token.Type);
+
+                if (stack.size() > Patch::MaxStackDepth)
                 {
-                    BinjaLog(ErrorLog, "Failed to decompress patch data for {0}", view.GetFile()->GetFilename());
+                    BinjaLog(ErrorLog, "Stack overflow (limit {0})", size_t(Patch::MaxStackDepth));
+
+                    return false;
                 }
+
+                continue;
+            }
+
+            BNLowLevelILOperation operation = static_cast<BNLowLevelILOperation>(token.Value);
+
+            if ((stack.size() < 3) ||
+                (stack.end()[-1] != TokenType::Operand) ||
+                (stack.end()[-2] != TokenType::Operand) ||
+                (stack.end()[-3] != TokenType::Operand))
+            {
+                BinjaLog(ErrorLog, "Missing Instruction Operands (expected 3, got {0})", stack.size());
+
+                return false;
             }
-            else
+
+            if (slots[i - 1] || slots[i - 2] || slots[i - 3])
             {
-                BinjaLog(ErrorLog, "Outdated or invalid patch data for {0}", view.GetFile()->GetFilename());
+                BinjaLog(ErrorLog, "Parameterized instruction size, flags or count");
+
+                return false;
+            }
+
+            size_t operand_count = tmpl.Tokens[i - 3].Value;
+
+            stack.resize(stack.size() - 3);
+
+            auto expected_operands = LowLevelILInstruction::operationOperandUsage.find(operation);
+
+            if (expected_operands == LowLevelILInstruction::operationOperandUsage.end())
+            {
+                BinjaLog(ErrorLog, "Bad Operation: {0}", token.Value);
+
+                return false;
+            }
+
+            size_t expected_operand_count = expected_operands->second.size();
+
+            if ((expected_operand_count != operand_count) || (operand_count > 4))
+            {
+                BinjaLog(ErrorLog, "Mismatched operand count (expected {0}, got {1})", expected_operand_count, operand_count);
+
+                return false;
+            }
+
+            if (stack.size() < operand_count)
+            {
+                BinjaLog(ErrorLog, "Missing Exprs (expected {0}, got {1})", operand_count, stack.size());
+
+                return false;
+            }
+
+            stack.resize(stack.size() - operand_count);
+            stack.push_back(token.Type);
+        }
+
+        for (TokenType type : stack)
+        {
+            if (type != TokenType::Instruction)
+            {
+                BinjaLog(ErrorLog, "Dangling operand");
+
+                return false;
             }
         }
+
+        return true;
     }
 
-    bool Patch::Evaluate(LowLevelILFunction& il) const
+    std::shared_ptr<const PatchTemplate> InternTemplate(PatchTemplate tmpl)
     {
-        std::vector<size_t> operands;
+        std::lock_guard<std::mutex> guard(TemplatePoolMutex);
 
-        for (const Token& token : Tokens)
+        auto iter = TemplatePool.find(&tmpl);
+
+        if (iter != TemplatePool.end())
+        {
+            if (std::shared_ptr<const PatchTemplate> pooled = iter->second.lock())
+            {
+                return pooled;
+            }
+
+            // The pooled template is being released, and its deleter will see that the entry is no longer its own
+            TemplatePool.erase(iter);
+        }
+
+        tmpl.Valid = DecodeTemplate(tmpl);
+
+        const PatchTemplate* created = new PatchTemplate(std::move(tmpl));
+
+        std::shared_ptr<const PatchTemplate> pooled(created, &ReleaseTemplate);
+
+        TemplatePool.emplace(created, pooled);
+
+        return pooled;
+    }
+
+    // Reads a patch's tokens, substituting its parameters into the template
+    class PatchTokenReader
+    {
+    protected:
+        const uint8_t* m_Code = nullptr;
+        const uint8_t* m_CodeEnd = nullptr;
+        const uint8_t* m_Params = nullptr;
+        const uint8_t* m_ParamsEnd = nullptr;
+        const uint32_t* m_Slot = nullptr;
+        const uint32_t* m_SlotEnd = nullptr;
+        uint32_t m_Index = 0;
+
+    public:
+        PatchTokenReader(const Patch& patch)
+            : m_Params(patch.Params)
+            , m_ParamsEnd(patch.Params + patch.ParamSize)
+        {
+            if (patch.Template)
+            {
+                m_Code = patch.Template->Code.data();
+                m_CodeEnd = m_Code + patch.Template->Code.size();
+                m_Slot = patch.Template->Slots.data();
+                m_SlotEnd = m_Slot + patch.Template->Slots.size();
+            }
+        }
+
+        bool AtEnd() const
+        {
+            return (m_Code == m_CodeEnd) && (m_Slot == m_SlotEnd) && (m_Params == m_ParamsEnd);
+        }
+
+        bool Next(Token& token)
         {
-            switch (token.Type)
+            if (!DecodeToken(m_Code, m_CodeEnd, token))
+            {
+                return false;
+            }
+
+            if ((m_Slot != m_SlotEnd) && (*m_Slot == m_Index))
             {
-                case TokenType::Instruction:
+                if (!DecodeToken(m_Params, m_ParamsEnd, token) || (token.Type != TokenType::Operand))
                 {
-                    BNLowLevelILOperation operation = static_cast<BNLowLevelILOperation>(token.Value);
+                    return false;
+                }
 
-                    if (operands.size() < 3)
-                    {
-                        BinjaLog(ErrorLog, "Missing Instruction Operands (expected 3, got {0})", operands.size());
+                ++m_Slot;
+            }
 
-                        return false;
-                    }
+            ++m_Index;
 
-                    size_t size = operands.back();
-                    operands.pop_back();
+            return true;
+        }
+    };
 
-                    uint32_t flags = static_cast<uint32_t>(operands.back());
-                    operands.pop_back();
+    Patch::Patch(size_t size, const std::vector<Token>& tokens)
+        : Size(static_cast<uint32_t>(size))
+    {
+        PatchTemplate tmpl;
+        std::vector<uint8_t> params;
 
-                    size_t operand_count = operands.back();
-                    operands.pop_back();
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            Token token = tokens[i];
 
-                    size_t expected_operand_count = LowLevelILInstruction::operationOperandUsage.at(operation).size();
+            if (token.Type == TokenType::Operand)
+            {
+                bool structural = false;
 
-                    if (expected_operand_count != operand_count)
+                // The count, flags and size operands directly precede their instruction
+                for (size_t j = i + 1; (j < tokens.size()) && (j <= i + 3); ++j)
+                {
+                    if (tokens[j].Type == TokenType::Instruction)
                     {
-                        BinjaLog(ErrorLog, "Mismatched operand count (expected {0}, got {1})", expected_operand_count, operand_count);
+                        structural = true;
 
-                        return false;
+                        break;
                     }
+                }
 
-                    if (operands.size() < operand_count)
-                    {
-                        BinjaLog(ErrorLog, "Missing Exprs (expected {0}, got {1})", operand_count, operands.size());
+                if (!structural)
+                {
+                    EncodeToken(params, token);
+                    tmpl.Slots.push_back(static_cast<uint32_t>(i));
 
-                        return false;
-                    }
+                    token.Value = 0;
+                }
+            }
+
+            EncodeToken(tmpl.Code, token);
+        }
+
+        ParamSize = static_cast<uint32_t>(params.size());
 
-                    size_t exprs[4]{};
-                    auto expr_iter = operands.end() - operand_count;
-                    std::copy_n(expr_iter, operand_count, exprs);
-                    operands.erase(expr_iter, operands.end());
+        if (ParamSize)
+        {
+            OwnedParams.reset(new uint8_t[ParamSize]);
+            std::copy_n(params.data(), ParamSize, OwnedParams.get());
 
-                    ExprId expr = il.AddExpr(operation, size, flags,
-                        static_cast<ExprId>(exprs[0]),
-                        static_cast<ExprId>(exprs[1]),
-                        static_cast<ExprId>(exprs[2]),
-                        static_cast<ExprId>(exprs[3])
-                    );
+            Params = OwnedParams.get();
+        }
 
-                    operands.push_back(static_cast<size_t>(expr));
+        tmpl.Code.shrink_to_fit();
+        tmpl.Slots.shrink_to_fit();
 
-                } break;
+        Template = InternTemplate(std::move(tmpl));
+    }
 
-                case TokenType::Operand:
-                {
-                    operands.push_back(token.Value);
-                } break;
+    Patch::Patch(size_t size, std::shared_ptr<const PatchTemplate> tmpl, const uint8_t* params, size_t param_size)
+        : Size(static_cast<uint32_t>(size))
+        , ParamSize(static_cast<uint32_t>(param_size))
+        , Template(std::move(tmpl))
+    {
+        if (ParamSize)
+        {
+            OwnedParams.reset(new uint8_t[ParamSize]);
+            std::copy_n(params, ParamSize, OwnedParams.get());
+
+            Params = OwnedParams.get();
+        }
+    }
+
+    std::vector<Token> Patch::GetTokens() const
+    {
+        std::vector<Token> tokens;
+
+        PatchTokenReader reader(*this);
+
+        Token token;
+
+        while (reader.Next(token))
+        {
+            tokens.push_back(token);
+        }
+
+        return tokens;
+    }
+
+    bool Patch::Verify()
+    {
+        Verified = false;
+
+        Values = nullptr;
+        OwnedValues.reset();
+
+        if (!Template)
+        {
+            Verified = (ParamSize == 0);
+
+            return Verified;
+        }
+
+        // The template's structure was checked once when it was interned, so only the parameters are left
+        if (!Template->Valid)
+        {
+            BinjaLog(ErrorLog, "Invalid patch template");
+
+            return false;
+        }
 
-                default:
+        const size_t code_size = Template->Code.size() + ParamSize;
+
+        if (code_size > MaxCodeSize)
+        {
+            BinjaLog(ErrorLog, "Patch too large ({0} bytes)", code_size);
+
+            return false;
+        }
+
+        const size_t slot_count = Template->Slots.size();
+
+        if (slot_count)
+        {
+            OwnedValues.reset(new size_t[slot_count]);
+        }
+
+        const uint8_t* params = Params;
+        const uint8_t* params_end = Params + ParamSize;
+
+        for (size_t i = 0; i < slot_count; ++i)
+        {
+            Token token;
+
+            if (!DecodeToken(params, params_end, token) || (token.Type != TokenType::Operand))
+            {
+                BinjaLog(ErrorLog, "Truncated Token");
+
+                return false;
+            }
+
+            OwnedValues[i] = token.Value;
+        }
+
+        if (params != params_end)
+        {
+            BinjaLog(ErrorLog, "Unused parameters ({0} bytes)", params_end - params);
+
+            return false;
+        }
+
+        Values = OwnedValues.get();
+        Verified = true;
+
+        return true;
+    }
+
+    bool Patch::Evaluate(LowLevelILFunction& il) const
+    {
+        if (!Verified)
+        {
+            return false;
+        }
+
+        if (!Template)
+        {
+            return true;
+        }
+
+        size_t stack[MaxStackDepth];
+        size_t depth = 0;
+
+        const std::vector<Token>& tokens = Template->Tokens;
+
+        const uint32_t* slot = Template->Slots.data();
+        const uint32_t* slot_end = slot + Template->Slots.size();
+        const size_t* value = Values;
+
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            const Token& token = tokens[i];
+
+            if (token.Type == TokenType::Operand)
+            {
+                if ((slot != slot_end) && (*slot == i))
+                {
+                    stack[depth++] = *value++;
+                    ++slot;
+                }
+                else
                 {
-                    BinjaLog(ErrorLog, "Bad Token: {0} - {1}", static_cast<int>(token.Type), token.Value);
+                    stack[depth++] = token.Value;
+                }
 
-                    return false;
-                } break;
+                continue;
             }
+
+            size_t size = stack[--depth];
+            uint32_t flags = static_cast<uint32_t>(stack[--depth]);
+            size_t operand_count = stack[--depth];
+
+            size_t exprs[4] {};
+            depth -= operand_count;
+            std::copy_n(stack + depth, operand_count, exprs);
+
+            ExprId expr = il.AddExpr(static_cast<BNLowLevelILOperation>(token.Value), size, flags,
+                static_cast<ExprId>(exprs[0]),
+                static_cast<ExprId>(exprs[1]),
+                static_cast<ExprId>(exprs[2]),
+                static_cast<ExprId>(exprs[3])
+            );
+
+            stack[depth++] = static_cast<size_t>(expr);
         }
 
-        for (size_t expr : operands)
+        for (size_t i = 0; i < depth; ++i)
         {
-            il.AddInstruction(static_cast<ExprId>(expr));
+            il.AddInstruction(static_cast<ExprId>(stack[i]));
         }
 
         return true;
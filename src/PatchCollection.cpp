@@ -0,0 +1,1765 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "PatchCollection.h"
+
+#include "DataBufferAdapter.h"
+#include "EpochReclaimer.h"
+#include "PatchDatabase.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <unordered_set>
+
+#include <bitsery/bitsery.h>
+#include <bitsery/traits/core/traits.h>
+#include <bitsery/traits/vector.h>
+#include <bitsery/flexible.h>
+#include <bitsery/flexible/unordered_map.h>
+#include <bitsery/flexible/vector.h>
+
+static const std::string PATCH_METADATA_KEY = "OBFU_PATCHES";
+static const std::string PATCH_CHUNK_KEY = "OBFU_PATCHES_CHUNK";
+static const std::string PATCH_JOURNAL_KEY = "OBFU_PATCHES_JOURNAL";
+static const std::string PATCH_METADATA_VERSION = "0.2.0";
+static const std::string PATCH_METADATA_VERSION_0_0_0 = "0.0.0";
+
+namespace PatchBuilder
+{
+    // Blobs hold each distinct template once, followed by the patches sorted by address.
+    // Saving serializes straight from the live patches and the pooled templates.
+    static const size_t MaxBlobEntries = 0x1000000;
+
+    struct PatchTemplateRef
+    {
+        const PatchTemplate* Value;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.object(const_cast<PatchTemplate&>(*Value));
+        };
+    };
+
+    // A patch's parameters in place, written with the same encoding as a std::vector<uint8_t>
+    struct PatchParamsRef
+    {
+        const uint8_t* Data;
+        size_t Size;
+
+        const uint8_t* begin() const
+        {
+            return Data;
+        }
+
+        const uint8_t* end() const
+        {
+            return Data + Size;
+        }
+    };
+}
+
+namespace bitsery
+{
+    namespace traits
+    {
+        template <>
+        struct ContainerTraits<PatchBuilder::PatchParamsRef>
+        {
+            using TValue = uint8_t;
+
+            // Only ever serialized, but written with a length prefix like a resizable container
+            static constexpr bool isResizable = true;
+            static constexpr bool isContiguous = true;
+
+            static size_t size(const PatchBuilder::PatchParamsRef& params)
+            {
+                return params.Size;
+            }
+        };
+    }
+}
+
+namespace PatchBuilder
+{
+    struct PatchRecordRef
+    {
+        uintptr_t Address;
+        const Patch* Value;
+        uint32_t Template;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.value8b(Address);
+            s.value4b(const_cast<uint32_t&>(Value->Size));
+            s.value4b(Template);
+
+            PatchParamsRef params { Value->Params, Value->ParamSize };
+
+            s.container1b(params, Patch::MaxCodeSize);
+        };
+    };
+
+    struct PatchBlobRef
+    {
+        std::vector<PatchTemplateRef> Templates;
+        std::vector<PatchRecordRef> Patches;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.container(Templates, MaxBlobEntries);
+            s.container(Patches, MaxBlobEntries);
+        };
+    };
+
+    // A record's parameters, read into a buffer the patch then takes ownership of
+    struct PatchParamsBuffer
+    {
+        std::unique_ptr<uint8_t[]> Data;
+        size_t Size = 0;
+
+        uint8_t* begin()
+        {
+            return Data.get();
+        }
+
+        uint8_t* end()
+        {
+            return Data.get() + Size;
+        }
+    };
+}
+
+namespace bitsery
+{
+    namespace traits
+    {
+        template <>
+        struct ContainerTraits<PatchBuilder::PatchParamsBuffer>
+        {
+            using TValue = uint8_t;
+
+            static constexpr bool isResizable = true;
+            static constexpr bool isContiguous = true;
+
+            static size_t size(const PatchBuilder::PatchParamsBuffer& params)
+            {
+                return params.Size;
+            }
+
+            static void resize(PatchBuilder::PatchParamsBuffer& params, size_t size)
+            {
+                params.Data.reset(size ? new uint8_t[size] : nullptr);
+                params.Size = size;
+            }
+        };
+    }
+}
+
+namespace PatchBuilder
+{
+    // Reads one record at a time straight into the patch map, rather than into a list of records first
+    struct PatchRecordReader
+    {
+        const std::vector<std::shared_ptr<const PatchTemplate>>* Templates;
+        PatchMap* Patches;
+        bool Valid = true;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            uintptr_t address = 0;
+            uint32_t size = 0;
+            uint32_t tmpl = 0;
+            PatchParamsBuffer params;
+
+            s.value8b(address);
+            s.value4b(size);
+            s.value4b(tmpl);
+            s.container1b(params, Patch::MaxCodeSize);
+
+            if (tmpl >= Templates->size())
+            {
+                Valid = false;
+
+                return;
+            }
+
+            Patch& patch = (*Patches)[address];
+
+            patch = Patch();
+            patch.Size = size;
+            patch.Template = (*Templates)[tmpl];
+            patch.ParamSize = static_cast<uint32_t>(params.Size);
+            patch.OwnedParams = std::move(params.Data);
+            patch.Params = patch.OwnedParams.get();
+        };
+    };
+
+    // Stands in for the record list. Every element is the same reader, so nothing is held per record.
+    struct PatchRecordSink
+    {
+        struct iterator
+        {
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = PatchRecordReader;
+            using difference_type = std::ptrdiff_t;
+            using pointer = PatchRecordReader*;
+            using reference = PatchRecordReader&;
+
+            PatchRecordReader* Reader;
+            size_t Index;
+
+            PatchRecordReader& operator*() const
+            {
+                return *Reader;
+            }
+
+            iterator& operator++()
+            {
+                ++Index;
+
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+                return Index == other.Index;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+                return Index != other.Index;
+            }
+        };
+
+        PatchRecordReader Reader;
+        size_t Count = 0;
+
+        iterator begin()
+        {
+            return { &Reader, 0 };
+        }
+
+        iterator end()
+        {
+            return { &Reader, Count };
+        }
+    };
+}
+
+namespace bitsery
+{
+    namespace traits
+    {
+        template <>
+        struct ContainerTraits<PatchBuilder::PatchRecordSink>
+        {
+            using TValue = PatchBuilder::PatchRecordReader;
+
+            static constexpr bool isResizable = true;
+            static constexpr bool isContiguous = false;
+
+            static size_t size(const PatchBuilder::PatchRecordSink& records)
+            {
+                return records.Count;
+            }
+
+            static void resize(PatchBuilder::PatchRecordSink& records, size_t size)
+            {
+                records.Count = size;
+            }
+        };
+    }
+}
+
+namespace PatchBuilder
+{
+    // Interns the templates as soon as they are read, then unpacks each record directly into the patch map
+    struct PatchBlobReader
+    {
+        std::vector<PatchTemplate> Templates;
+        std::vector<std::shared_ptr<const PatchTemplate>> Interned;
+        PatchRecordSink Patches;
+
+        PatchBlobReader(PatchMap& patches)
+        {
+            Patches.Reader.Templates = &Interned;
+            Patches.Reader.Patches = &patches;
+        }
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.container(Templates, MaxBlobEntries);
+
+            Interned.reserve(Templates.size());
+
+            for (PatchTemplate& tmpl : Templates)
+            {
+                Interned.push_back(InternTemplate(std::move(tmpl)));
+            }
+
+            Templates.clear();
+
+            s.container(Patches, MaxBlobEntries);
+        };
+    };
+
+    // Estimates how much blob data is buffered at once during a save or load, from the sizes of the blobs and the
+    // nominal adapter window size. Nothing is measured, and allocations made by bitsery, the codecs or the core aren't
+    // counted, so the logged figure is an estimate only.
+    struct BufferUsage
+    {
+        size_t Current = 0;
+        size_t Peak = 0;
+
+        void Acquire(size_t size)
+        {
+            Current += size;
+            Peak = std::max(Peak, Current);
+        }
+
+        void Release(size_t size)
+        {
+            Current -= size;
+        }
+    };
+
+    // Patch layout used by version 0.0.0, with unpacked 9 byte tokens
+    struct LegacyPatch
+    {
+        size_t Size;
+        std::vector<Token> Tokens;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.value8b(Size);
+            s.container(Tokens, 4096);
+        };
+    };
+
+    bitsery::ReaderError LoadLegacyPatches(DataBuffer& db, PatchMap& patches)
+    {
+        std::unordered_map<uintptr_t, LegacyPatch> legacy;
+
+        bitsery::ReaderError error = bitsery::quickDeserialization<InputDataBufferAdapater>({ db }, legacy).first;
+
+        if (error == bitsery::ReaderError::NoError)
+        {
+            for (const auto& patch : legacy)
+            {
+                patches.emplace(patch.first, Patch(patch.second.Size, patch.second.Tokens));
+            }
+        }
+
+        return error;
+    }
+
+    std::string GetJournalSegmentKey(size_t index)
+    {
+        return PATCH_JOURNAL_KEY + "_" + std::to_string(index);
+    }
+
+    std::string GetChunkKey(uintptr_t start)
+    {
+        return fmt::format("{0}_{1:x}", PATCH_CHUNK_KEY, start);
+    }
+
+    PatchBlobRef MakePatchBlob(PatchRefs& patches)
+    {
+        std::sort(patches.begin(), patches.end());
+
+        static const PatchTemplate EmptyTemplate;
+
+        PatchBlobRef blob;
+        std::unordered_map<const PatchTemplate*, uint32_t> templates;
+
+        blob.Patches.reserve(patches.size());
+
+        for (const PatchEntryRef& patch : patches)
+        {
+            const PatchTemplate* tmpl = patch.Value->Template ? patch.Value->Template.get() : &EmptyTemplate;
+
+            auto index = templates.emplace(tmpl, static_cast<uint32_t>(blob.Templates.size()));
+
+            if (index.second)
+            {
+                blob.Templates.push_back({ tmpl });
+            }
+
+            blob.Patches.push_back({ patch.Address, patch.Value, index.first->second });
+        }
+
+        return blob;
+    }
+
+    bool StorePatches(BinaryView& view, const std::string& key, PatchRefs& patches, BufferUsage& usage)
+    {
+        PatchBlobRef blob = MakePatchBlob(patches);
+
+        const DataBufferCodec& codec = DataBufferCodec::GetDefaultCodec();
+
+        DataBuffer compressed;
+
+        // Compresses as it serializes, so only the compressed blob and two windows are ever buffered
+        size_t written = bitsery::quickSerialization<OutputCompressedDataBufferAdapater>({ compressed, codec }, blob);
+
+        usage.Acquire(compressed.GetLength() + (OutputCompressedDataBufferAdapater::DefaultWindowSize * 2));
+
+        if (!written)
+        {
+            BinjaLog(ErrorLog, "Failed to serialize patch data for {0}", view.GetFile()->GetFilename());
+
+            return false;
+        }
+
+        usage.Release(OutputCompressedDataBufferAdapater::DefaultWindowSize * 2);
+
+        Ref<Metadata> metadata = new Metadata
+        ({
+            { "version", new Metadata(PATCH_METADATA_VERSION) },
+            { "codec", new Metadata(static_cast<uint64_t>(codec.GetId())) },
+            { "data", new Metadata(BNCreateMetadataRawData(static_cast<const uint8_t*>(compressed.GetData()), compressed.GetLength())) }
+        });
+
+        usage.Release(compressed.GetLength());
+
+        view.StoreMetadata(key, metadata);
+
+        BinjaLog(DebugLog, "Stored {0} patches using {1} templates under {2}", blob.Patches.size(), blob.Templates.size(), key);
+
+        return true;
+    }
+
+    bool QueryPatches(const std::string& name, Ref<Metadata> metadata, PatchMap& patches, bool& outdated, BufferUsage& usage)
+    {
+        if (!metadata || !metadata->IsKeyValueStore())
+        {
+            return false;
+        }
+
+        std::map<std::string, Ref<Metadata>> data = metadata->GetKeyValueStore();
+
+        std::string version = data.at("version")->GetString();
+
+        bool current = version == PATCH_METADATA_VERSION;
+        bool legacy = version == PATCH_METADATA_VERSION_0_0_0;
+
+        if (!current && !legacy)
+        {
+            BinjaLog(ErrorLog, "Outdated or invalid patch data for {0}", name);
+
+            return false;
+        }
+
+        const DataBufferCodec* codec = nullptr;
+
+        if (current)
+        {
+            auto codec_data = data.find("codec");
+
+            uint32_t codec_id = (codec_data != data.end()) ? static_cast<uint32_t>(codec_data->second->GetUnsignedInteger()) : DataBufferCodec::Zlib;
+
+            codec = DataBufferCodec::GetCodec(codec_id);
+
+            if (codec == nullptr)
+            {
+                BinjaLog(ErrorLog, "Unknown codec {0} for patch data {1}", codec_id, name);
+
+                return false;
+            }
+        }
+
+        size_t raw_size = 0;
+        uint8_t* raw = BNMetadataGetRaw(data.at("data")->m_object, &raw_size);
+
+        if (raw == nullptr)
+        {
+            BinjaLog(ErrorLog, "Missing patch data for {0}", name);
+
+            return false;
+        }
+
+        usage.Acquire(raw_size);
+
+        bitsery::ReaderError error = bitsery::ReaderError::NoError;
+
+        if (current)
+        {
+            // Frames are decompressed straight out of the raw metadata, one window at a time
+            usage.Acquire(OutputCompressedDataBufferAdapater::DefaultWindowSize);
+
+            PatchMap decoded;
+            PatchBlobReader blob(decoded);
+
+            error = bitsery::quickDeserialization<InputCompressedDataBufferAdapater>({ raw, raw_size, *codec }, blob).first;
+
+            BNFreeMetadataRaw(raw);
+
+            usage.Release(OutputCompressedDataBufferAdapater::DefaultWindowSize + raw_size);
+
+            if ((error == bitsery::ReaderError::NoError) && !blob.Patches.Reader.Valid)
+            {
+                error = bitsery::ReaderError::InvalidData;
+            }
+
+            if (error == bitsery::ReaderError::NoError)
+            {
+                if (patches.empty())
+                {
+                    patches.swap(decoded);
+                }
+                else
+                {
+                    for (auto& patch : decoded)
+                    {
+                        patches[patch.first] = std::move(patch.second);
+                    }
+                }
+            }
+        }
+        else
+        {
+            // The core only inflates from a DataBuffer, so the legacy format still takes a copy
+            DataBuffer compressed(raw, raw_size);
+            BNFreeMetadataRaw(raw);
+
+            DataBuffer db;
+
+            if (!compressed.ZlibDecompress(db))
+            {
+                usage.Release(raw_size);
+
+                BinjaLog(ErrorLog, "Failed to decompress patch data for {0}", name);
+
+                return false;
+            }
+
+            usage.Acquire(db.GetLength());
+            usage.Release(raw_size);
+
+            compressed.Clear();
+
+            error = LoadLegacyPatches(db, patches);
+
+            usage.Release(db.GetLength());
+        }
+
+        if (error != bitsery::ReaderError::NoError)
+        {
+            BinjaLog(ErrorLog, "Failed to deserialize patch data for {0}", name);
+
+            return false;
+        }
+
+        if (!current)
+        {
+            outdated = true;
+        }
+
+        return true;
+    }
+
+    PatchCollection::~PatchCollection()
+    {
+        delete m_Table.load(std::memory_order_relaxed);
+        delete m_ChunkIndex.load(std::memory_order_relaxed);
+        delete m_Imports.load(std::memory_order_relaxed);
+    }
+
+    uintptr_t PatchCollection::GetChunkStart(uintptr_t address)
+    {
+        return address & ~(ChunkSpan - 1);
+    }
+
+    PatchTable* PatchCollection::Publish(size_t capacity, const PatchTable* source)
+    {
+        std::unique_ptr<PatchTable> table(new PatchTable(capacity));
+
+        if (source)
+        {
+            source->ForEach([&] (uintptr_t address, const Patch& patch)
+            {
+                table->Insert(address, &patch);
+            });
+        }
+
+        PatchTable* result = table.release();
+
+        if (PatchTable* previous = m_Table.exchange(result, std::memory_order_acq_rel))
+        {
+            EpochReclaimer::Retire(std::unique_ptr<PatchTable>(previous));
+        }
+
+        return result;
+    }
+
+    bool PatchCollection::InsertPatch(uintptr_t address, Patch patch)
+    {
+        PatchTable* table = m_Table.load(std::memory_order_relaxed);
+
+        if (table && table->Find(address))
+        {
+            return false;
+        }
+
+        if (!table || table->IsFull())
+        {
+            table = Publish(table ? (table->GetSize() * 2) : 0, table);
+        }
+
+        StorePatch(address, std::move(patch), *table);
+
+        return true;
+    }
+
+    void PatchCollection::StorePatch(uintptr_t address, Patch patch, PatchTable& table)
+    {
+        const Patch* stored = m_Storage->Store(std::move(patch));
+
+        m_Index.push_back({ address, stored });
+
+        m_Totals.Add(*stored);
+
+        if (stored->Template)
+        {
+            m_Templates.insert(stored->Template.get());
+        }
+
+        table.Insert(address, stored);
+    }
+
+    void PatchCollection::SortIndex() const
+    {
+        if (m_IndexSorted == m_Index.size())
+        {
+            return;
+        }
+
+        auto middle = m_Index.begin() + m_IndexSorted;
+
+        std::sort(middle, m_Index.end());
+        std::inplace_merge(m_Index.begin(), middle, m_Index.end());
+
+        m_IndexSorted = m_Index.size();
+    }
+
+    void PatchCollection::LoadChunk(ChunkIndex& chunks, uintptr_t address)
+    {
+        const uintptr_t start = GetChunkStart(address);
+
+        Chunk* begin = chunks.Chunks.get();
+        Chunk* end = begin + chunks.Count;
+
+        Chunk* chunk = std::lower_bound(begin, end, start, [ ] (const Chunk& chunk, uintptr_t start)
+        {
+            return chunk.Start < start;
+        });
+
+        if ((chunk == end) || (chunk->Start != start) || !chunk->Pending.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> chunk_guard(m_ChunkMutex);
+
+        // A concurrent Load may have replaced the index, and with it everything this chunk would insert
+        if ((m_ChunkIndex.load(std::memory_order_relaxed) != &chunks) || !chunk->Pending.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        PatchMap patches;
+        bool outdated = false;
+
+        BufferUsage usage;
+
+        if (QueryPatches(GetChunkKey(start), chunk->Data, patches, outdated, usage))
+        {
+            BinjaLog(DebugLog, "Loaded {0} patches from chunk 0x{1:x} (buffer estimate {2} bytes)", patches.size(), start, usage.Peak);
+        }
+        else
+        {
+            BinjaLog(ErrorLog, "Failed to load patch chunk 0x{0:x}", start);
+        }
+
+        for (auto iter = patches.begin(); iter != patches.end();)
+        {
+            if (iter->second.Verify())
+            {
+                ++iter;
+            }
+            else
+            {
+                BinjaLog(ErrorLog, "Discarded invalid patch @ 0x{0:x}", iter->first);
+
+                iter = patches.erase(iter);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            // Patches added since the chunk was saved take priority
+            for (auto& patch : patches)
+            {
+                InsertPatch(patch.first, std::move(patch.second));
+            }
+        }
+
+        chunk->Data = nullptr;
+        chunk->Pending.store(false, std::memory_order_release);
+        chunks.Pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void PatchCollection::LoadAllChunks()
+    {
+        EpochReclaimer::Guard epoch;
+
+        ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire);
+
+        if (chunks == nullptr)
+        {
+            return;
+        }
+
+        for (size_t i = 0; (i < chunks->Count) && chunks->Pending.load(std::memory_order_acquire); ++i)
+        {
+            LoadChunk(*chunks, chunks->Chunks[i].Start);
+        }
+    }
+
+    void PatchCollection::LoadChunks(uintptr_t start, uintptr_t end)
+    {
+        EpochReclaimer::Guard epoch;
+
+        ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire);
+
+        if ((chunks == nullptr) || !chunks->Pending.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < chunks->Count; ++i)
+        {
+            const uintptr_t chunk = chunks->Chunks[i].Start;
+
+            if ((chunk + ChunkSpan > start) && (chunk < end))
+            {
+                LoadChunk(*chunks, chunk);
+            }
+        }
+    }
+
+    void PatchCollection::LoadRecord(ImportedDatabase& imported, size_t index)
+    {
+        // Cleared once every record is loaded, or when a Load drops the import
+        if (!imported.Pending.load(std::memory_order_relaxed) || imported.Loaded[index])
+        {
+            return;
+        }
+
+        imported.Loaded[index] = true;
+
+        if (--imported.Remaining == 0)
+        {
+            imported.Pending.store(false, std::memory_order_release);
+        }
+
+        const PatchDatabase& database = *imported.Database;
+        const PatchDatabase::Record& record = database.GetRecord(index);
+        const uintptr_t address = static_cast<uintptr_t>(record.Address);
+
+        // Existing patches take priority
+        if (const PatchTable* table = m_Table.load(std::memory_order_relaxed))
+        {
+            if (table->Find(address))
+            {
+                return;
+            }
+        }
+
+        std::shared_ptr<const PatchTemplate>& tmpl = imported.Templates[record.Template];
+
+        if (!tmpl)
+        {
+            tmpl = InternTemplate(database.GetTemplate(record.Template));
+        }
+
+        Patch patch;
+
+        patch.Size = record.Size;
+        patch.ParamSize = record.ParamSize;
+        patch.Template = tmpl;
+        patch.Params = database.GetData(record.ParamOffset);
+
+        if (!patch.Verify())
+        {
+            BinjaLog(ErrorLog, "Discarded invalid patch @ 0x{0:x}", address);
+
+            return;
+        }
+
+        if (InsertPatch(address, std::move(patch)))
+        {
+            m_Dirty.push_back(address);
+        }
+    }
+
+    bool PatchCollection::LoadImport(uintptr_t address)
+    {
+        EpochReclaimer::Guard epoch;
+
+        ImportIndex* imports = m_Imports.load(std::memory_order_acquire);
+
+        if (imports == nullptr)
+        {
+            return false;
+        }
+
+        bool found = false;
+
+        for (const std::shared_ptr<ImportedDatabase>& imported : imports->Databases)
+        {
+            if (!imported->Pending.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            const PatchDatabase& database = *imported->Database;
+
+            if (const PatchDatabase::Record* record = database.Find(address))
+            {
+                std::lock_guard<std::mutex> guard(m_Mutex);
+
+                LoadRecord(*imported, static_cast<size_t>(record - &database.GetRecord(0)));
+
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    void PatchCollection::LoadImports(uintptr_t start, uintptr_t end)
+    {
+        EpochReclaimer::Guard epoch;
+
+        ImportIndex* imports = m_Imports.load(std::memory_order_acquire);
+
+        if (imports == nullptr)
+        {
+            return;
+        }
+
+        LoadChunks(start, end);
+
+        for (const std::shared_ptr<ImportedDatabase>& imported : imports->Databases)
+        {
+            if (!imported->Pending.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            const PatchDatabase& database = *imported->Database;
+
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            for (size_t i = database.LowerBound(start); (i < database.GetPatchCount()) && (database.GetRecord(i).Address < end); ++i)
+            {
+                LoadRecord(*imported, i);
+            }
+        }
+    }
+
+    void PatchCollection::LoadAllImports()
+    {
+        EpochReclaimer::Guard epoch;
+
+        ImportIndex* imports = m_Imports.load(std::memory_order_acquire);
+
+        if (imports == nullptr)
+        {
+            return;
+        }
+
+        for (const std::shared_ptr<ImportedDatabase>& imported : imports->Databases)
+        {
+            if (!imported->Pending.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            const PatchDatabase& database = *imported->Database;
+            const size_t count = database.GetPatchCount();
+
+            LoadChunks(database.GetRecord(0).Address, database.GetRecord(count - 1).Address + 1);
+
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            // Size the table for the whole database up front, rather than doubling it repeatedly
+            PatchTable* table = m_Table.load(std::memory_order_relaxed);
+
+            const size_t required = (table ? table->GetSize() : 0) + imported->Remaining;
+
+            if (!table || ((required * 2) > table->GetCapacity()))
+            {
+                Publish(required, table);
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                LoadRecord(*imported, i);
+            }
+        }
+    }
+
+    PatchRefs PatchCollection::GetPatches(const std::set<uintptr_t>& chunks) const
+    {
+        PatchRefs patches;
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        SortIndex();
+
+        for (uintptr_t start : chunks)
+        {
+            auto begin = std::lower_bound(m_Index.begin(), m_Index.end(), PatchEntryRef { start, nullptr });
+            auto end = std::lower_bound(begin, m_Index.end(), PatchEntryRef { start + ChunkSpan, nullptr });
+
+            patches.insert(patches.end(), begin, end);
+        }
+
+        return patches;
+    }
+
+    PatchRefs PatchCollection::GetPatches(uintptr_t start, uintptr_t end)
+    {
+        LoadChunks(start, end);
+        LoadImports(start, end);
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        SortIndex();
+
+        auto lower = std::lower_bound(m_Index.begin(), m_Index.end(), PatchEntryRef { start, nullptr });
+        auto upper = std::lower_bound(lower, m_Index.end(), PatchEntryRef { end, nullptr });
+
+        return PatchRefs(lower, upper);
+    }
+
+    void PatchCollection::AddPatch(uintptr_t address, Patch patch)
+    {
+        EpochReclaimer::Guard epoch;
+
+        if (ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire))
+        {
+            if (chunks->Pending.load(std::memory_order_relaxed))
+            {
+                LoadChunk(*chunks, address);
+            }
+        }
+
+        LoadImport(address);
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        if (InsertPatch(address, std::move(patch)))
+        {
+            m_Dirty.push_back(address);
+        }
+    }
+
+    const Patch* PatchCollection::GetPatch(uintptr_t address)
+    {
+        EpochReclaimer::Guard epoch;
+
+        if (ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire))
+        {
+            if (chunks->Pending.load(std::memory_order_relaxed))
+            {
+                LoadChunk(*chunks, address);
+            }
+        }
+
+        const PatchTable* table = m_Table.load(std::memory_order_acquire);
+
+        if (table && table->GetSize())
+        {
+            if (const Patch* patch = table->Find(address))
+            {
+                return patch;
+            }
+        }
+
+        // Imported records are only decoded and verified the first time they're looked up
+        if (!LoadImport(address))
+        {
+            return nullptr;
+        }
+
+        table = m_Table.load(std::memory_order_acquire);
+
+        return table ? table->Find(address) : nullptr;
+    }
+
+    PatchStatistics PatchCollection::GetStatistics()
+    {
+        EpochReclaimer::Guard epoch;
+
+        PatchStatistics stats;
+
+        // Chunks are only marked loaded while both locks are held, so nothing is counted twice or missed
+        std::lock_guard<std::mutex> chunk_guard(m_ChunkMutex);
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        stats.Loaded = m_Totals;
+        stats.Templates = m_Templates.size();
+
+        if (const ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire))
+        {
+            for (size_t i = 0; i < chunks->Count; ++i)
+            {
+                if (chunks->Chunks[i].Pending.load(std::memory_order_relaxed))
+                {
+                    ++stats.UnloadedChunks;
+
+                    stats.Unloaded.Add(chunks->Chunks[i].Totals);
+                }
+            }
+        }
+
+        if (const ImportIndex* imports = m_Imports.load(std::memory_order_acquire))
+        {
+            for (const std::shared_ptr<ImportedDatabase>& imported : imports->Databases)
+            {
+                if (imported->Pending.load(std::memory_order_relaxed))
+                {
+                    stats.UnloadedImports += imported->Remaining;
+                }
+            }
+        }
+
+        return stats;
+    }
+
+    bool PatchCollection::StoreBase(BinaryView& view, const std::vector<uintptr_t>& dirty, bool full)
+    {
+        std::set<uintptr_t> touched;
+
+        if (full)
+        {
+            LoadAllChunks();
+            LoadAllImports();
+
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            for (const PatchEntryRef& patch : m_Index)
+            {
+                touched.insert(GetChunkStart(patch.Address));
+            }
+        }
+        else
+        {
+            for (uintptr_t address : m_Journaled)
+            {
+                touched.insert(GetChunkStart(address));
+            }
+
+            for (uintptr_t address : dirty)
+            {
+                touched.insert(GetChunkStart(address));
+            }
+
+            EpochReclaimer::Guard epoch;
+
+            if (ChunkIndex* chunks = m_ChunkIndex.load(std::memory_order_acquire))
+            {
+                for (uintptr_t start : touched)
+                {
+                    LoadChunk(*chunks, start);
+                }
+            }
+        }
+
+        std::map<uintptr_t, PatchRefs> groups;
+
+        for (const PatchEntryRef& patch : GetPatches(touched))
+        {
+            groups[GetChunkStart(patch.Address)].push_back(patch);
+        }
+
+        BufferUsage usage;
+
+        std::map<uintptr_t, PatchTotals> base_chunks;
+
+        if (!full)
+        {
+            base_chunks = m_BaseChunks;
+        }
+
+        for (auto& group : groups)
+        {
+            if (!StorePatches(view, GetChunkKey(group.first), group.second, usage))
+            {
+                return false;
+            }
+
+            PatchTotals& totals = base_chunks[group.first];
+
+            totals = PatchTotals();
+
+            for (const PatchEntryRef& patch : group.second)
+            {
+                totals.Add(*patch.Value);
+            }
+        }
+
+        std::vector<Ref<Metadata>> starts;
+        std::vector<Ref<Metadata>> counts;
+        std::vector<Ref<Metadata>> token_bytes;
+        std::vector<Ref<Metadata>> param_bytes;
+
+        size_t base_count = 0;
+
+        for (const auto& chunk : base_chunks)
+        {
+            starts.push_back(new Metadata(uint64_t(chunk.first)));
+            counts.push_back(new Metadata(uint64_t(chunk.second.Count)));
+            token_bytes.push_back(new Metadata(uint64_t(chunk.second.TokenBytes)));
+            param_bytes.push_back(new Metadata(uint64_t(chunk.second.ParamBytes)));
+
+            base_count += chunk.second.Count;
+        }
+
+        // The totals let statistics cover chunks which haven't been decoded
+        Ref<Metadata> index = new Metadata
+        ({
+            { "version", new Metadata(PATCH_METADATA_VERSION) },
+            { "chunks", new Metadata(starts) },
+            { "counts", new Metadata(counts) },
+            { "token_bytes", new Metadata(token_bytes) },
+            { "param_bytes", new Metadata(param_bytes) }
+        });
+
+        view.StoreMetadata(PATCH_METADATA_KEY, index);
+
+        for (const auto& chunk : m_BaseChunks)
+        {
+            if (base_chunks.find(chunk.first) == base_chunks.end())
+            {
+                view.RemoveMetadata(GetChunkKey(chunk.first));
+            }
+        }
+
+        BinjaLog(DebugLog, "Saved {0} patch chunks ({1} patches) for {2} (buffer estimate {3} bytes)", groups.size(), base_count, view.GetFile()->GetFilename(), usage.Peak);
+
+        m_BaseChunks = std::move(base_chunks);
+        m_BaseCount = base_count;
+
+        return true;
+    }
+
+    void PatchCollection::Save(BinaryView& view)
+    {
+        std::lock_guard<std::mutex> save_guard(m_SaveMutex);
+
+        // Imported records are only marked dirty once decoded
+        LoadAllImports();
+
+        PatchRefs patches;
+        std::vector<uintptr_t> dirty;
+
+        BufferUsage usage;
+
+        bool compact = false;
+        bool merge = false;
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            if (m_Dirty.empty() && !m_Compact)
+            {
+                return;
+            }
+
+            dirty.swap(m_Dirty);
+
+            // Rewriting the base once the journal outgrows it keeps the amortized cost proportional to the new patches
+            compact = m_Compact || ((m_Journaled.size() + dirty.size()) >= m_BaseCount);
+            merge = !compact && (m_JournalSegments >= MaxJournalSegments);
+
+            const PatchTable* table = m_Table.load(std::memory_order_relaxed);
+
+            if (!compact)
+            {
+                if (merge)
+                {
+                    for (uintptr_t address : m_Journaled)
+                    {
+                        if (const Patch* patch = table->Find(address))
+                        {
+                            patches.push_back({ address, patch });
+                        }
+                    }
+                }
+
+                for (uintptr_t address : dirty)
+                {
+                    if (const Patch* patch = table->Find(address))
+                    {
+                        patches.push_back({ address, patch });
+                    }
+                }
+            }
+        }
+
+        // Every step writes the new data before dropping the old, so an interrupted save only leaves duplicates behind
+        if (compact)
+        {
+            // Only the chunks containing journaled or dirty patches are rewritten, unless the base is outdated
+            if (StoreBase(view, dirty, m_Compact))
+            {
+                view.StoreMetadata(PATCH_JOURNAL_KEY, new Metadata(uint64_t(0)));
+
+                for (size_t i = 0; i < m_JournalSegments; ++i)
+                {
+                    view.RemoveMetadata(GetJournalSegmentKey(i));
+                }
+
+                m_Journaled.clear();
+                m_JournalSegments = 0;
+                m_Compact = false;
+
+                return;
+            }
+        }
+        else if (merge)
+        {
+            if (StorePatches(view, GetJournalSegmentKey(0), patches, usage))
+            {
+                view.StoreMetadata(PATCH_JOURNAL_KEY, new Metadata(uint64_t(1)));
+
+                for (size_t i = 1; i < m_JournalSegments; ++i)
+                {
+                    view.RemoveMetadata(GetJournalSegmentKey(i));
+                }
+
+                m_Journaled.clear();
+
+                for (const PatchEntryRef& patch : patches)
+                {
+                    m_Journaled.push_back(patch.Address);
+                }
+
+                m_JournalSegments = 1;
+
+                BinjaLog(DebugLog, "Merged {0} journaled patches for {1} (buffer estimate {2} bytes)", patches.size(), view.GetFile()->GetFilename(), usage.Peak);
+
+                return;
+            }
+        }
+        else
+        {
+            if (StorePatches(view, GetJournalSegmentKey(m_JournalSegments), patches, usage))
+            {
+                view.StoreMetadata(PATCH_JOURNAL_KEY, new Metadata(uint64_t(m_JournalSegments + 1)));
+
+                m_Journaled.insert(m_Journaled.end(), dirty.begin(), dirty.end());
+                m_JournalSegments += 1;
+
+                BinjaLog(DebugLog, "Journaled {0} patches for {1} (buffer estimate {2} bytes)", patches.size(), view.GetFile()->GetFilename(), usage.Peak);
+
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        m_Dirty.insert(m_Dirty.end(), dirty.begin(), dirty.end());
+    }
+
+    void PatchCollection::Load(BinaryView& view)
+    {
+        std::lock_guard<std::mutex> save_guard(m_SaveMutex);
+
+        const std::string name = view.GetFile()->GetFilename();
+
+        PatchMap loaded;
+        bool outdated = false;
+
+        BufferUsage usage;
+
+        std::unique_ptr<ChunkIndex> chunks(new ChunkIndex());
+        std::map<uintptr_t, PatchTotals> base_chunks;
+        size_t base_count = 0;
+
+        Ref<Metadata> base = view.QueryMetadata(PATCH_METADATA_KEY);
+
+        if (base && base->IsKeyValueStore())
+        {
+            std::map<std::string, Ref<Metadata>> data = base->GetKeyValueStore();
+
+            if (data.find("chunks") == data.end())
+            {
+                // Version 0.0.0 stored the base as a single blob, which is decoded now and rewritten as chunks
+                if (QueryPatches(name, base, loaded, outdated, usage))
+                {
+                    BinjaLog(InfoLog, "Successfully loaded patch data for {0}", name);
+
+                    base_count = loaded.size();
+                    outdated = true;
+                }
+            }
+            else if (data.at("version")->GetString() == PATCH_METADATA_VERSION)
+            {
+                std::vector<Ref<Metadata>> starts = data.at("chunks")->GetArray();
+                std::vector<Ref<Metadata>> counts = data.at("counts")->GetArray();
+
+                // Indices saved before the byte totals were recorded count those as zero, until the next save
+                std::vector<Ref<Metadata>> token_bytes;
+                std::vector<Ref<Metadata>> param_bytes;
+
+                if ((data.find("token_bytes") != data.end()) && (data.find("param_bytes") != data.end()))
+                {
+                    token_bytes = data.at("token_bytes")->GetArray();
+                    param_bytes = data.at("param_bytes")->GetArray();
+                }
+
+                for (size_t i = 0; (i < starts.size()) && (i < counts.size()); ++i)
+                {
+                    PatchTotals totals;
+
+                    totals.Count = static_cast<size_t>(counts[i]->GetUnsignedInteger());
+
+                    if ((i < token_bytes.size()) && (i < param_bytes.size()))
+                    {
+                        totals.TokenBytes = static_cast<size_t>(token_bytes[i]->GetUnsignedInteger());
+                        totals.ParamBytes = static_cast<size_t>(param_bytes[i]->GetUnsignedInteger());
+                    }
+
+                    base_chunks.emplace(static_cast<uintptr_t>(starts[i]->GetUnsignedInteger()), totals);
+                }
+
+                chunks->Chunks.reset(new Chunk[base_chunks.size()]);
+
+                for (const auto& chunk : base_chunks)
+                {
+                    Ref<Metadata> chunk_data = view.QueryMetadata(GetChunkKey(chunk.first));
+
+                    if (!chunk_data)
+                    {
+                        BinjaLog(ErrorLog, "Missing patch chunk 0x{0:x} for {1}", chunk.first, name);
+
+                        outdated = true;
+
+                        continue;
+                    }
+
+                    Chunk& entry = chunks->Chunks[chunks->Count++];
+
+                    entry.Start = chunk.first;
+                    entry.Data = chunk_data;
+                    entry.Totals = chunk.second;
+                    entry.Pending.store(true, std::memory_order_relaxed);
+
+                    base_count += chunk.second.Count;
+                }
+
+                chunks->Pending.store(chunks->Count, std::memory_order_relaxed);
+
+                BinjaLog(InfoLog, "Successfully loaded patch index ({0} chunks) for {1}", chunks->Count, name);
+            }
+            else
+            {
+                BinjaLog(ErrorLog, "Outdated or invalid patch data for {0}", name);
+            }
+        }
+
+        size_t segments = 0;
+
+        std::vector<uintptr_t> journaled;
+
+        Ref<Metadata> journal = view.QueryMetadata(PATCH_JOURNAL_KEY);
+
+        if (journal && journal->IsUnsignedInteger())
+        {
+            segments = static_cast<size_t>(journal->GetUnsignedInteger());
+        }
+
+        for (size_t i = 0; i < segments; ++i)
+        {
+            PatchMap segment;
+
+            if (!QueryPatches(name, view.QueryMetadata(GetJournalSegmentKey(i)), segment, outdated, usage))
+            {
+                BinjaLog(ErrorLog, "Missing patch journal segment {0} for {1}", i, name);
+
+                outdated = true;
+
+                continue;
+            }
+
+            for (auto& patch : segment)
+            {
+                journaled.push_back(patch.first);
+
+                loaded[patch.first] = std::move(patch.second);
+            }
+        }
+
+        std::sort(journaled.begin(), journaled.end());
+        journaled.erase(std::unique(journaled.begin(), journaled.end()), journaled.end());
+
+        BinjaLog(DebugLog, "Loaded {0} eager patches for {1} (buffer estimate {2} bytes)", loaded.size(), name, usage.Peak);
+
+        m_BaseChunks = std::move(base_chunks);
+        m_BaseCount = base_count;
+        m_Journaled = std::move(journaled);
+        m_JournalSegments = segments;
+        m_Compact = outdated;
+
+        std::lock_guard<std::mutex> chunk_guard(m_ChunkMutex);
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        PatchTable* table = Publish(loaded.size(), nullptr);
+
+        // Everything previously loaded or imported is replaced, and freed once no lifter can still be using it
+        std::unique_ptr<PatchArena> storage(new PatchArena());
+
+        storage.swap(m_Storage);
+
+        EpochReclaimer::Retire(std::move(storage));
+
+        if (ImportIndex* imports = m_Imports.exchange(nullptr, std::memory_order_acq_rel))
+        {
+            // Stops any lookup already holding the index from decoding into the new table
+            for (const std::shared_ptr<ImportedDatabase>& imported : imports->Databases)
+            {
+                imported->Pending.store(false, std::memory_order_relaxed);
+            }
+
+            EpochReclaimer::Retire(std::unique_ptr<ImportIndex>(imports));
+        }
+
+        m_Index.clear();
+        m_IndexSorted = 0;
+
+        m_Totals = PatchTotals();
+        m_Templates.clear();
+
+        for (auto& patch : loaded)
+        {
+            if (!patch.second.Verify())
+            {
+                BinjaLog(ErrorLog, "Discarded invalid patch @ 0x{0:x}", patch.first);
+
+                continue;
+            }
+
+            StorePatch(patch.first, std::move(patch.second), *table);
+        }
+
+        if (ChunkIndex* previous = m_ChunkIndex.exchange(chunks.release(), std::memory_order_acq_rel))
+        {
+            EpochReclaimer::Retire(std::unique_ptr<ChunkIndex>(previous));
+        }
+
+        m_Dirty.clear();
+    }
+
+    bool PatchCollection::Export(const std::string& path)
+    {
+        LoadAllChunks();
+        LoadAllImports();
+
+        EpochReclaimer::Guard epoch;
+
+        PatchRefs patches;
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            SortIndex();
+
+            patches = m_Index;
+        }
+
+        return PatchDatabase::Write(path, patches);
+    }
+
+    void PatchCollection::Import(std::shared_ptr<const PatchDatabase> database)
+    {
+        const size_t count = database->GetPatchCount();
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        // The database was validated when opened, so nothing is decoded here
+        std::shared_ptr<ImportedDatabase> imported(new ImportedDatabase());
+
+        imported->Templates.resize(database->GetTemplateCount());
+        imported->Loaded.resize(count, false);
+        imported->Remaining = count;
+        imported->Database = std::move(database);
+
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        std::unique_ptr<ImportIndex> imports(new ImportIndex());
+
+        if (const ImportIndex* previous = m_Imports.load(std::memory_order_relaxed))
+        {
+            imports->Databases = previous->Databases;
+        }
+
+        imports->Databases.push_back(std::move(imported));
+
+        if (ImportIndex* previous = m_Imports.exchange(imports.release(), std::memory_order_acq_rel))
+        {
+            EpochReclaimer::Retire(std::unique_ptr<ImportIndex>(previous));
+        }
+    }
+
+    void PatchCollection::BenchmarkCodecs()
+    {
+        LoadAllChunks();
+        LoadAllImports();
+
+        EpochReclaimer::Guard epoch;
+
+        PatchRefs patches;
+
+        size_t table_bytes = 0;
+        size_t index_bytes = 0;
+        size_t arena_reserved = 0;
+        size_t arena_used = 0;
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            SortIndex();
+
+            patches = m_Index;
+
+            if (const PatchTable* table = m_Table.load(std::memory_order_relaxed))
+            {
+                table_bytes = table->GetMemoryUsage();
+            }
+
+            index_bytes = m_Index.capacity() * sizeof(PatchEntryRef);
+            arena_reserved = m_Storage->GetReserved();
+            arena_used = m_Storage->GetUsed();
+        }
+
+        if (patches.empty())
+        {
+            BinjaLog(WarningLog, "No patches to benchmark");
+
+            return;
+        }
+
+        using clock = std::chrono::steady_clock;
+
+        std::unordered_set<const PatchTemplate*> templates;
+        size_t template_bytes = 0;
+
+        for (const PatchEntryRef& patch : patches)
+        {
+            const PatchTemplate* tmpl = patch.Value->Template.get();
+
+            if (tmpl && templates.insert(tmpl).second)
+            {
+                template_bytes += sizeof(PatchTemplate) + tmpl->Code.capacity() +
+                    (tmpl->Slots.capacity() * sizeof(uint32_t)) + (tmpl->Tokens.capacity() * sizeof(Token));
+            }
+        }
+
+        const size_t total_bytes = table_bytes + index_bytes + arena_reserved + template_bytes;
+
+        BinjaLog(InfoLog, "Storage: {0} bytes ({1:.1f} per patch), table {2}, index {3}, arena {4} ({5} used), {6} templates {7}",
+            total_bytes, static_cast<double>(total_bytes) / patches.size(), table_bytes, index_bytes,
+            arena_reserved, arena_used, templates.size(), template_bytes);
+
+        // Point lookups in a random order, as lifting visits functions, and just past each patch for misses
+        {
+            static const size_t Iterations = 8;
+
+            std::vector<uintptr_t> addresses;
+
+            addresses.reserve(patches.size());
+
+            for (const PatchEntryRef& patch : patches)
+            {
+                addresses.push_back(patch.Address);
+            }
+
+            std::shuffle(addresses.begin(), addresses.end(), std::mt19937_64(0));
+
+            size_t hits = 0;
+
+            clock::time_point start = clock::now();
+
+            for (size_t i = 0; i < Iterations; ++i)
+            {
+                for (uintptr_t address : addresses)
+                {
+                    hits += GetPatch(address) != nullptr;
+                }
+            }
+
+            clock::time_point middle = clock::now();
+
+            for (size_t i = 0; i < Iterations; ++i)
+            {
+                for (uintptr_t address : addresses)
+                {
+                    hits += GetPatch(address + 1) != nullptr;
+                }
+            }
+
+            clock::time_point end = clock::now();
+
+            const double lookups = static_cast<double>(addresses.size() * Iterations);
+
+            BinjaLog(InfoLog, "Lookups: {0:.1f} ns per hit, {1:.1f} ns per miss ({2} found)",
+                std::chrono::duration<double, std::nano>(middle - start).count() / lookups,
+                std::chrono::duration<double, std::nano>(end - middle).count() / lookups, hits);
+        }
+
+        PatchBlobRef blob = MakePatchBlob(patches);
+
+        DataBuffer db;
+
+        clock::time_point serialize_start = clock::now();
+
+        size_t written = bitsery::quickSerialization<OutputDataBufferAdapater>(db, blob);
+
+        const double serialize_time = std::chrono::duration<double>(clock::now() - serialize_start).count();
+
+        db.SetSize(written);
+
+        BinjaLog(InfoLog, "Serialized {0} patches ({1} bytes) in {2:.1f} ms, {3:.1f} MB/s", patches.size(), written,
+            serialize_time * 1000, static_cast<double>(written) / (1024 * 1024) / serialize_time);
+
+        // Split into the same windows used when saving
+        std::vector<DataBuffer> windows;
+
+        const size_t window_size = OutputCompressedDataBufferAdapater::DefaultWindowSize;
+
+        for (size_t offset = 0; offset < written; offset += window_size)
+        {
+            size_t size = std::min(written - offset, window_size);
+
+            windows.emplace_back(db.GetDataAt(offset), size);
+        }
+
+        BinjaLog(InfoLog, "Benchmarking codecs on {0} patches ({1} bytes serialized)", patches.size(), written);
+
+        for (const DataBufferCodec* codec : DataBufferCodec::GetCodecs())
+        {
+            static const size_t Iterations = 3;
+
+            std::vector<DataBuffer> frames(windows.size());
+            DataBuffer output;
+
+            double compress_time = 0;
+            double decompress_time = 0;
+            bool valid = true;
+
+            for (size_t i = 0; i < Iterations; ++i)
+            {
+                clock::time_point start = clock::now();
+
+                for (size_t j = 0; j < windows.size(); ++j)
+                {
+                    valid &= codec->Compress(windows[j], frames[j]);
+                }
+
+                clock::time_point middle = clock::now();
+
+                for (size_t j = 0; j < windows.size(); ++j)
+                {
+                    valid &= codec->Decompress(static_cast<const uint8_t*>(frames[j].GetData()), frames[j].GetLength(), windows[j].GetLength(), output);
+                }
+
+                clock::time_point end = clock::now();
+
+                compress_time += std::chrono::duration<double>(middle - start).count();
+                decompress_time += std::chrono::duration<double>(end - middle).count();
+            }
+
+            if (!valid)
+            {
+                BinjaLog(ErrorLog, "{0}: failed to round trip", codec->GetName());
+
+                continue;
+            }
+
+            size_t compressed = 0;
+
+            for (const DataBuffer& frame : frames)
+            {
+                compressed += frame.GetLength();
+            }
+
+            const double megabytes = static_cast<double>(written * Iterations) / (1024 * 1024);
+
+            BinjaLog(InfoLog, "{0}: {1} bytes ({2:.2f}x), compress {3:.1f} MB/s, decompress {4:.1f} MB/s",
+                codec->GetName(), compressed, compressed ? (static_cast<double>(written) / compressed) : 0.0,
+                megabytes / compress_time, megabytes / decompress_time);
+        }
+    }
+
+    void PatchCollection::LoadAsync(WorkStealingPool& pool, Ref<BinaryView> view)
+    {
+        std::shared_ptr<std::promise<void>> loaded(new std::promise<void>());
+
+        m_LoadFuture = loaded->get_future().share();
+
+        // The view reference is dropped last, as releasing it may destroy the view and this collection with it
+        pool.Submit([this, view, loaded] () mutable
+        {
+            try
+            {
+                Load(*view);
+            }
+            catch (const std::exception& e)
+            {
+                BinjaLog(ErrorLog, "Failed to load patches: {0}", e.what());
+            }
+
+            m_Loaded.store(true, std::memory_order_release);
+            loaded->set_value();
+
+            view = nullptr;
+        });
+    }
+
+    void PatchCollection::WaitForLoad()
+    {
+        if (!m_Loaded.load(std::memory_order_acquire))
+        {
+            m_LoadFuture.wait();
+        }
+    }
+}
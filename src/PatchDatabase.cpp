@@ -0,0 +1,416 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "PatchDatabase.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace PatchBuilder
+{
+    static const char PATCH_DATABASE_MAGIC[8] = { 'O', 'B', 'F', 'U', 'P', 'A', 'T', 'C' };
+
+    static_assert(sizeof(PatchDatabase::Header) == 72, "Unexpected header layout");
+    static_assert(sizeof(PatchDatabase::Record) == 32, "Unexpected record layout");
+    static_assert(sizeof(PatchDatabase::TemplateRecord) == 24, "Unexpected template layout");
+
+    static uint64_t AlignPage(uint64_t offset)
+    {
+        return (offset + (PatchDatabase::PageSize - 1)) & ~static_cast<uint64_t>(PatchDatabase::PageSize - 1);
+    }
+
+    // Checks that [offset, offset + count * size) lies within [0, limit)
+    static bool InBounds(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit)
+    {
+        return (offset <= limit) && (count <= ((limit - offset) / size));
+    }
+
+    PatchDatabase::~PatchDatabase()
+    {
+        if (m_Data == nullptr)
+        {
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(m_Data);
+        CloseHandle(m_Mapping);
+#else
+        munmap(const_cast<uint8_t*>(m_Data), m_Size);
+#endif
+    }
+
+    std::shared_ptr<const PatchDatabase> PatchDatabase::Open(const std::string& path)
+    {
+        std::shared_ptr<PatchDatabase> database(new PatchDatabase());
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            BinjaLog(ErrorLog, "Failed to open patch database {0}", path);
+
+            return nullptr;
+        }
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size) || (size.QuadPart < static_cast<LONGLONG>(sizeof(Header))))
+        {
+            CloseHandle(file);
+
+            BinjaLog(ErrorLog, "Invalid patch database {0}", path);
+
+            return nullptr;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        CloseHandle(file);
+
+        if (mapping == nullptr)
+        {
+            BinjaLog(ErrorLog, "Failed to map patch database {0}", path);
+
+            return nullptr;
+        }
+
+        const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+        if (data == nullptr)
+        {
+            CloseHandle(mapping);
+
+            BinjaLog(ErrorLog, "Failed to map patch database {0}", path);
+
+            return nullptr;
+        }
+
+        database->m_Mapping = mapping;
+        database->m_Data = static_cast<const uint8_t*>(data);
+        database->m_Size = static_cast<size_t>(size.QuadPart);
+#else
+        int file = open(path.c_str(), O_RDONLY);
+
+        if (file == -1)
+        {
+            BinjaLog(ErrorLog, "Failed to open patch database {0}", path);
+
+            return nullptr;
+        }
+
+        struct stat info;
+
+        if ((fstat(file, &info) == -1) || (info.st_size < static_cast<off_t>(sizeof(Header))))
+        {
+            close(file);
+
+            BinjaLog(ErrorLog, "Invalid patch database {0}", path);
+
+            return nullptr;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+        close(file);
+
+        if (data == MAP_FAILED)
+        {
+            BinjaLog(ErrorLog, "Failed to map patch database {0}", path);
+
+            return nullptr;
+        }
+
+        database->m_Data = static_cast<const uint8_t*>(data);
+        database->m_Size = static_cast<size_t>(info.st_size);
+#endif
+
+        database->m_Header = reinterpret_cast<const Header*>(database->m_Data);
+
+        if (!database->Validate())
+        {
+            BinjaLog(ErrorLog, "Invalid or unsupported patch database {0}", path);
+
+            return nullptr;
+        }
+
+        database->m_Records = reinterpret_cast<const Record*>(database->m_Data + database->m_Header->RecordsOffset);
+        database->m_Templates = reinterpret_cast<const TemplateRecord*>(database->m_Data + database->m_Header->TemplatesOffset);
+
+        return database;
+    }
+
+    bool PatchDatabase::Validate() const
+    {
+        const Header& header = *m_Header;
+
+        if (std::memcmp(header.Magic, PATCH_DATABASE_MAGIC, sizeof(header.Magic)) ||
+            (header.ByteOrder != ByteOrder) ||
+            (header.Version != Version) ||
+            (header.PageSize != PageSize))
+        {
+            return false;
+        }
+
+        if ((header.RecordsOffset % PageSize) || (header.TemplatesOffset % PageSize) || (header.DataOffset % PageSize))
+        {
+            return false;
+        }
+
+        if (!InBounds(header.RecordsOffset, header.PatchCount, sizeof(Record), m_Size) ||
+            !InBounds(header.TemplatesOffset, header.TemplateCount, sizeof(TemplateRecord), m_Size) ||
+            !InBounds(header.DataOffset, header.DataSize, 1, m_Size))
+        {
+            return false;
+        }
+
+        const TemplateRecord* templates = reinterpret_cast<const TemplateRecord*>(m_Data + header.TemplatesOffset);
+
+        for (uint64_t i = 0; i < header.TemplateCount; ++i)
+        {
+            const TemplateRecord& tmpl = templates[i];
+
+            if (!InBounds(tmpl.CodeOffset, tmpl.CodeSize, 1, header.DataSize) ||
+                !InBounds(tmpl.SlotOffset, tmpl.SlotCount, sizeof(uint32_t), header.DataSize) ||
+                (tmpl.CodeSize > PatchTemplate::MaxCodeSize) ||
+                (tmpl.SlotCount > PatchTemplate::MaxCodeSize))
+            {
+                return false;
+            }
+        }
+
+        // Lookups binary search the records, so they must be strictly ascending
+        const Record* records = reinterpret_cast<const Record*>(m_Data + header.RecordsOffset);
+
+        for (uint64_t i = 0; i < header.PatchCount; ++i)
+        {
+            const Record& record = records[i];
+
+            if ((record.Template >= header.TemplateCount) ||
+                !InBounds(record.ParamOffset, record.ParamSize, 1, header.DataSize) ||
+                ((i != 0) && (records[i - 1].Address >= record.Address)))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool PatchDatabase::Write(const std::string& path, const PatchRefs& patches)
+    {
+        static const PatchTemplate EmptyTemplate;
+
+        std::vector<Record> records;
+        std::vector<TemplateRecord> templates;
+        std::vector<uint8_t> data;
+
+        std::unordered_map<const PatchTemplate*, uint32_t> template_indices;
+
+        auto append = [&] (const void* bytes, size_t size)
+        {
+            const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+
+            data.insert(data.end(), begin, begin + size);
+        };
+
+        records.reserve(patches.size());
+
+        for (const PatchEntryRef& patch : patches)
+        {
+            const PatchTemplate* tmpl = patch.Value->Template ? patch.Value->Template.get() : &EmptyTemplate;
+
+            auto index = template_indices.emplace(tmpl, static_cast<uint32_t>(templates.size()));
+
+            if (index.second)
+            {
+                TemplateRecord record {};
+
+                record.CodeOffset = data.size();
+                record.CodeSize = static_cast<uint32_t>(tmpl->Code.size());
+                append(tmpl->Code.data(), tmpl->Code.size());
+
+                data.resize((data.size() + 3) & ~size_t(3));
+
+                record.SlotOffset = data.size();
+                record.SlotCount = static_cast<uint32_t>(tmpl->Slots.size());
+                append(tmpl->Slots.data(), tmpl->Slots.size() * sizeof(uint32_t));
+
+                templates.push_back(record);
+            }
+
+            Record record {};
+
+            record.Address = patch.Address;
+            record.Size = patch.Value->Size;
+            record.Template = index.first->second;
+            record.ParamOffset = data.size();
+            record.ParamSize = patch.Value->ParamSize;
+            append(patch.Value->Params, patch.Value->ParamSize);
+
+            records.push_back(record);
+        }
+
+        std::sort(records.begin(), records.end(), [ ] (const Record& lhs, const Record& rhs)
+        {
+            return lhs.Address < rhs.Address;
+        });
+
+        Header header {};
+
+        std::memcpy(header.Magic, PATCH_DATABASE_MAGIC, sizeof(header.Magic));
+        header.ByteOrder = ByteOrder;
+        header.Version = Version;
+        header.PageSize = PageSize;
+        header.PatchCount = records.size();
+        header.TemplateCount = templates.size();
+        header.RecordsOffset = AlignPage(sizeof(Header));
+        header.TemplatesOffset = AlignPage(header.RecordsOffset + (records.size() * sizeof(Record)));
+        header.DataOffset = AlignPage(header.TemplatesOffset + (templates.size() * sizeof(TemplateRecord)));
+        header.DataSize = data.size();
+
+        // The target may still be mapped by an open database, so never truncate it in place.
+        // Write a new file alongside it and rename it over the target, leaving existing mappings on the old file.
+        const std::string temp_path = path + ".tmp";
+
+        std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+
+        if (!output)
+        {
+            BinjaLog(ErrorLog, "Failed to create patch database {0}", temp_path);
+
+            return false;
+        }
+
+        auto write_section = [&] (uint64_t offset, const void* bytes, size_t size)
+        {
+            static const char padding[PageSize] = {};
+
+            output.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(output.tellp())));
+            output.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+        };
+
+        write_section(0, &header, sizeof(header));
+        write_section(header.RecordsOffset, records.data(), records.size() * sizeof(Record));
+        write_section(header.TemplatesOffset, templates.data(), templates.size() * sizeof(TemplateRecord));
+        write_section(header.DataOffset, data.data(), data.size());
+        write_section(AlignPage(header.DataOffset + data.size()), nullptr, 0);
+
+        output.close();
+
+        if (!output)
+        {
+            std::remove(temp_path.c_str());
+
+            BinjaLog(ErrorLog, "Failed to write patch database {0}", temp_path);
+
+            return false;
+        }
+
+#ifdef _WIN32
+        const bool renamed = MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+        const bool renamed = std::rename(temp_path.c_str(), path.c_str()) == 0;
+#endif
+
+        if (!renamed)
+        {
+            std::remove(temp_path.c_str());
+
+            BinjaLog(ErrorLog, "Failed to replace patch database {0}", path);
+
+            return false;
+        }
+
+        BinjaLog(InfoLog, "Exported {0} patches ({1} templates) to {2}", records.size(), templates.size(), path);
+
+        return true;
+    }
+
+    size_t PatchDatabase::GetPatchCount() const
+    {
+        return static_cast<size_t>(m_Header->PatchCount);
+    }
+
+    size_t PatchDatabase::GetTemplateCount() const
+    {
+        return static_cast<size_t>(m_Header->TemplateCount);
+    }
+
+    const PatchDatabase::Record& PatchDatabase::GetRecord(size_t index) const
+    {
+        return m_Records[index];
+    }
+
+    const PatchDatabase::Record* PatchDatabase::Find(uintptr_t address) const
+    {
+        const size_t index = LowerBound(address);
+
+        if ((index != GetPatchCount()) && (m_Records[index].Address == address))
+        {
+            return &m_Records[index];
+        }
+
+        return nullptr;
+    }
+
+    size_t PatchDatabase::LowerBound(uintptr_t address) const
+    {
+        const Record* end = m_Records + GetPatchCount();
+
+        const Record* record = std::lower_bound(m_Records, end, address, [ ] (const Record& lhs, uintptr_t rhs)
+        {
+            return lhs.Address < rhs;
+        });
+
+        return static_cast<size_t>(record - m_Records);
+    }
+
+    PatchTemplate PatchDatabase::GetTemplate(size_t index) const
+    {
+        const TemplateRecord& record = m_Templates[index];
+
+        PatchTemplate tmpl;
+
+        const uint8_t* code = GetData(record.CodeOffset);
+
+        tmpl.Code.assign(code, code + record.CodeSize);
+        tmpl.Slots.resize(record.SlotCount);
+
+        std::memcpy(tmpl.Slots.data(), GetData(record.SlotOffset), record.SlotCount * sizeof(uint32_t));
+
+        return tmpl;
+    }
+
+    const uint8_t* PatchDatabase::GetData(uint64_t offset) const
+    {
+        return m_Data + m_Header->DataOffset + offset;
+    }
+}
@@ -0,0 +1,145 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "PatchTable.h"
+
+namespace PatchBuilder
+{
+    uint64_t PatchTable::Hash(uintptr_t address)
+    {
+        uint64_t hash = static_cast<uint64_t>(address);
+
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ULL;
+        hash ^= hash >> 33;
+
+        return hash;
+    }
+
+    uint64_t PatchTable::FilterBits(uint64_t hash)
+    {
+        return (1ULL << ((hash >> 52) & 63)) | (1ULL << ((hash >> 58) & 63));
+    }
+
+    PatchTable::PatchTable(size_t capacity)
+        : m_Mask(0)
+        , m_Size(0)
+    {
+        size_t slots = 16;
+
+        while (slots < (capacity * 2))
+        {
+            slots *= 2;
+        }
+
+        m_Mask = slots - 1;
+        m_Slots.reset(new Slot[slots]);
+
+        for (size_t i = 0; i < slots; ++i)
+        {
+            m_Slots[i].Address.store(0, std::memory_order_relaxed);
+            m_Slots[i].Value.store(nullptr, std::memory_order_relaxed);
+        }
+
+        // 8 filter bits per slot, so at least 16 per address
+        size_t words = slots / 8;
+
+        m_FilterMask = words - 1;
+        m_Filter.reset(new std::atomic<uint64_t>[words]);
+
+        for (size_t i = 0; i < words; ++i)
+        {
+            m_Filter[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    const Patch* PatchTable::Find(uintptr_t address) const
+    {
+        const uint64_t hash = Hash(address);
+        const uint64_t bits = FilterBits(hash);
+
+        if ((m_Filter[(hash >> 32) & m_FilterMask].load(std::memory_order_relaxed) & bits) != bits)
+        {
+            return nullptr;
+        }
+
+        for (size_t i = static_cast<size_t>(hash);; ++i)
+        {
+            const Slot& slot = m_Slots[i & m_Mask];
+
+            const Patch* patch = slot.Value.load(std::memory_order_acquire);
+
+            if (patch == nullptr)
+            {
+                return nullptr;
+            }
+
+            if (slot.Address.load(std::memory_order_relaxed) == address)
+            {
+                return patch;
+            }
+        }
+    }
+
+    bool PatchTable::Insert(uintptr_t address, const Patch* patch)
+    {
+        const uint64_t hash = Hash(address);
+
+        for (size_t i = static_cast<size_t>(hash);; ++i)
+        {
+            Slot& slot = m_Slots[i & m_Mask];
+
+            if (slot.Value.load(std::memory_order_relaxed) == nullptr)
+            {
+                m_Filter[(hash >> 32) & m_FilterMask].fetch_or(FilterBits(hash), std::memory_order_relaxed);
+
+                // The address must be visible before the value, readers treat a null value as the end of the chain
+                slot.Address.store(address, std::memory_order_relaxed);
+                slot.Value.store(patch, std::memory_order_release);
+
+                m_Size.fetch_add(1, std::memory_order_relaxed);
+
+                return true;
+            }
+
+            if (slot.Address.load(std::memory_order_relaxed) == address)
+            {
+                return false;
+            }
+        }
+    }
+
+    bool PatchTable::IsFull() const
+    {
+        return (GetSize() * 2) >= GetCapacity();
+    }
+
+    size_t PatchTable::GetSize() const
+    {
+        return m_Size.load(std::memory_order_relaxed);
+    }
+
+    size_t PatchTable::GetCapacity() const
+    {
+        return m_Mask + 1;
+    }
+
+    size_t PatchTable::GetMemoryUsage() const
+    {
+        return (GetCapacity() * sizeof(Slot)) + ((m_FilterMask + 1) * sizeof(uint64_t));
+    }
+}
@@ -0,0 +1,177 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "TraceRecorder.h"
+
+#include "BinaryNinja.h"
+
+#include "fmt/format.h"
+
+#include <fstream>
+#include <mutex>
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* Category;
+        const char* Name;
+        uint32_t Thread;
+        int64_t Start;
+        int64_t Duration;
+        std::vector<std::pair<const char*, std::string>> Args;
+    };
+
+    std::mutex TraceMutex;
+    std::vector<TraceEvent> TraceEvents;
+    TraceRecorder::Clock::time_point TraceStart;
+    uint64_t NextSession = 1;
+
+    // Small, stable ids read better in a trace viewer than hashed std::thread::ids
+    std::atomic<uint32_t> NextThreadId {1};
+    thread_local uint32_t ThreadId = 0;
+
+    uint32_t GetThreadId()
+    {
+        if (ThreadId == 0)
+        {
+            ThreadId = NextThreadId.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return ThreadId;
+    }
+
+    std::string EscapeJson(const std::string& value)
+    {
+        std::string result;
+        result.reserve(value.size());
+
+        for (char c : value)
+        {
+            switch (c)
+            {
+                case '"': result += "\\\""; break;
+                case '\\': result += "\\\\"; break;
+                case '\n': result += "\\n"; break;
+                case '\t': result += "\\t"; break;
+
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        result += fmt::format("\\u{0:04x}", static_cast<unsigned char>(c));
+                    }
+                    else
+                    {
+                        result += c;
+                    }
+                    break;
+            }
+        }
+
+        return result;
+    }
+}
+
+std::atomic<uint64_t> TraceRecorder::Session {0};
+
+void TraceRecorder::Start()
+{
+    std::lock_guard<std::mutex> guard(TraceMutex);
+
+    TraceEvents.clear();
+    TraceStart = Clock::now();
+
+    Session.store(NextSession++, std::memory_order_relaxed);
+
+    BinjaLog(InfoLog, "Started tracing");
+}
+
+void TraceRecorder::Record(uint64_t session, const char* category, const char* name,
+    Clock::time_point start, Clock::time_point end, std::vector<std::pair<const char*, std::string>> args)
+{
+    const uint32_t thread = GetThreadId();
+
+    std::lock_guard<std::mutex> guard(TraceMutex);
+
+    // Spans which were still open when the trace stopped belong to no trace
+    if (Session.load(std::memory_order_relaxed) != session)
+    {
+        return;
+    }
+
+    TraceEvents.push_back({ category, name, thread,
+        std::chrono::duration_cast<std::chrono::microseconds>(start - TraceStart).count(),
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+        std::move(args) });
+}
+
+bool TraceRecorder::Stop(const std::string& path)
+{
+    std::vector<TraceEvent> events;
+
+    {
+        std::lock_guard<std::mutex> guard(TraceMutex);
+
+        Session.store(0, std::memory_order_relaxed);
+
+        events.swap(TraceEvents);
+    }
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+
+    if (!output)
+    {
+        BinjaLog(ErrorLog, "Failed to open {0} for writing", path);
+
+        return false;
+    }
+
+    output << "{\"traceEvents\":[\n";
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const TraceEvent& event = events[i];
+
+        output << fmt::format(R"({{"ph":"X","cat":"{0}","name":"{1}","pid":1,"tid":{2},"ts":{3},"dur":{4})",
+            event.Category, event.Name, event.Thread, event.Start, event.Duration);
+
+        if (!event.Args.empty())
+        {
+            output << ",\"args\":{";
+
+            for (size_t j = 0; j < event.Args.size(); ++j)
+            {
+                output << fmt::format(R"({0}"{1}":"{2}")", j ? "," : "", event.Args[j].first, EscapeJson(event.Args[j].second));
+            }
+
+            output << "}";
+        }
+
+        output << ((i + 1 < events.size()) ? "},\n" : "}\n");
+    }
+
+    output << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!output)
+    {
+        BinjaLog(ErrorLog, "Failed to write trace to {0}", path);
+
+        return false;
+    }
+
+    BinjaLog(InfoLog, "Wrote {0} trace events to {1}", events.size(), path);
+
+    return true;
+}
@@ -0,0 +1,225 @@
+// Copyright (C) 2018 Brick
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "WorkStealingPool.h"
+
+#include "BinaryNinja.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+    thread_local const WorkStealingPool* CurrentPool = nullptr;
+    thread_local size_t CurrentQueue = 0;
+}
+
+size_t WorkStealingPool::GetDefaultThreadCount()
+{
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+{
+    threads = std::max<size_t>(threads, 1);
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_Queues.emplace_back(new Queue());
+    }
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_Threads.emplace_back(&WorkStealingPool::WorkerMain, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    Wait();
+
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        m_Stopping = true;
+    }
+
+    m_JobQueued.notify_all();
+
+    for (std::thread& thread : m_Threads)
+    {
+        thread.join();
+    }
+}
+
+size_t WorkStealingPool::GetThreadCount() const
+{
+    return m_Threads.size();
+}
+
+bool WorkStealingPool::Pop(size_t index, Job& job)
+{
+    {
+        Queue& queue = *m_Queues[index];
+
+        std::lock_guard<std::mutex> guard(queue.Mutex);
+
+        if (!queue.Jobs.empty())
+        {
+            job = std::move(queue.Jobs.back());
+            queue.Jobs.pop_back();
+
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < m_Queues.size(); ++i)
+    {
+        Queue& victim = *m_Queues[(index + i) % m_Queues.size()];
+
+        std::lock_guard<std::mutex> guard(victim.Mutex);
+
+        if (!victim.Jobs.empty())
+        {
+            job = std::move(victim.Jobs.front());
+            victim.Jobs.pop_front();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::WorkerMain(size_t index)
+{
+    CurrentPool = this;
+    CurrentQueue = index;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+
+            m_JobQueued.wait(lock, [&] { return m_Stopping || (m_Queued != 0); });
+
+            if (m_Queued == 0)
+            {
+                break;
+            }
+        }
+
+        Job job;
+
+        // Submit counts a job before queueing it, so this can briefly miss
+        if (!Pop(index, job))
+        {
+            std::this_thread::yield();
+
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            --m_Queued;
+        }
+
+        try
+        {
+            job();
+        }
+        catch (const std::exception& e)
+        {
+            BinjaLog(ErrorLog, "Worker job failed: {0}", e.what());
+        }
+
+        bool idle = false;
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+
+            idle = (--m_Pending == 0);
+        }
+
+        if (idle)
+        {
+            m_Idle.notify_all();
+        }
+    }
+}
+
+void WorkStealingPool::Submit(Job job)
+{
+    size_t index = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        ++m_Queued;
+        ++m_Pending;
+
+        index = (CurrentPool == this) ? CurrentQueue : (m_NextQueue++ % m_Queues.size());
+    }
+
+    {
+        Queue& queue = *m_Queues[index];
+
+        std::lock_guard<std::mutex> guard(queue.Mutex);
+
+        queue.Jobs.push_back(std::move(job));
+    }
+
+    m_JobQueued.notify_one();
+}
+
+void WorkStealingPool::Cancel()
+{
+    std::vector<Job> cancelled;
+
+    for (const std::unique_ptr<Queue>& queue : m_Queues)
+    {
+        std::lock_guard<std::mutex> guard(queue->Mutex);
+
+        std::move(queue->Jobs.begin(), queue->Jobs.end(), std::back_inserter(cancelled));
+        queue->Jobs.clear();
+    }
+
+    bool idle = false;
+
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+
+        m_Queued -= cancelled.size();
+        m_Pending -= cancelled.size();
+
+        idle = (m_Pending == 0);
+    }
+
+    if (idle)
+    {
+        m_Idle.notify_all();
+    }
+
+    // Released outside the locks, as the jobs may hold references whose release does real work
+    cancelled.clear();
+}
+
+void WorkStealingPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    m_Idle.wait(lock, [&] { return m_Pending == 0; });
+}
@@ -19,6 +19,12 @@
 #include "PatchBuilder.h"
 #include "ObfuPasses.h"
 #include "BackgroundTaskThread.h"
+#include "ObfuPassRegistry.h"
+#include "TraceRecorder.h"
+#include "HookStatistics.h"
+#include "AssociatedDataStore.h"
+
+#include <cstdlib>
 
 void RegisterObfuHook(const std::string& arch_name)
 {
@@ -39,6 +45,108 @@ void FixObfuscationTask(Ref<BinaryView> view, Ref<Function> func)
     FixObfuscation(nullptr, view, func, false);
 }
 
+void FixObfuscationBatchTask(Ref<BinaryView> view, std::vector<Ref<Function>> funcs)
+{
+    if (funcs.empty())
+    {
+        return;
+    }
+
+    Ref<BackgroundTaskThread> task = new BackgroundTaskThread("De-Obfuscating");
+
+    task->Run(&FixObfuscationBatch, view, std::move(funcs), true);
+}
+
+void FixObfuscationAllTask(BinaryView* view)
+{
+    FixObfuscationBatchTask(view, view->GetAnalysisFunctionList());
+}
+
+void FixObfuscationSelectedTask(BinaryView* view, uint64_t start, uint64_t length)
+{
+    std::vector<Ref<Function>> funcs;
+
+    for (const Ref<Function>& func : view->GetAnalysisFunctionList())
+    {
+        if ((func->GetStart() >= start) && (func->GetStart() - start < length))
+        {
+            funcs.push_back(func);
+        }
+    }
+
+    // A selection inside a single function still means that function
+    if (funcs.empty())
+    {
+        funcs = view->GetAnalysisFunctionsContainingAddress(start);
+    }
+
+    FixObfuscationBatchTask(view, std::move(funcs));
+}
+
+void LogPassStatisticsTask(BinaryView* view)
+{
+    (void)view;
+
+    ObfuPassRegistry::LogStatistics();
+}
+
+void ResetPassStatisticsTask(BinaryView* view)
+{
+    (void)view;
+
+    ObfuPassRegistry::ResetStatistics();
+}
+
+void StartTraceTask(BinaryView* view)
+{
+    (void)view;
+
+    TraceRecorder::Start();
+}
+
+void StopTraceTask(BinaryView* view)
+{
+    if (!TraceRecorder::IsRecording())
+    {
+        BinjaLog(WarningLog, "No trace is running");
+
+        return;
+    }
+
+    std::string path;
+
+    if (GetSaveFileNameInput(path, "Save Trace", "*.json", view->GetFile()->GetFilename() + ".trace.json"))
+    {
+        TraceRecorder::Stop(path);
+    }
+}
+
+void LogHookStatisticsTask(BinaryView* view)
+{
+    HookStatistics::Log(*view);
+}
+
+void ResetHookStatisticsTask(BinaryView* view)
+{
+    (void)view;
+
+    HookStatistics::Reset();
+}
+
+// Long running commands get their own thread, like the background fix, rather than blocking the UI
+template <typename Func>
+void RunBackgroundTask(const std::string& text, Ref<BinaryView> view, Func func)
+{
+    Ref<BackgroundTaskThread> task = new BackgroundTaskThread(text);
+
+    task->Run([ ] (BackgroundTaskThread* task, Ref<BinaryView> view, Func func)
+    {
+        (void)task;
+
+        func(*view);
+    }, view, std::move(func));
+}
+
 void LoadPatchesTask(BinaryView* view)
 {
     PatchBuilder::LoadPatches(*view);
@@ -49,6 +157,58 @@ void SavePatchesTask(BinaryView* view)
     PatchBuilder::SavePatches(*view);
 }
 
+void ExportPatchesTask(BinaryView* view)
+{
+    std::string path;
+
+    if (GetSaveFileNameInput(path, "Export Patches", "*.patches", view->GetFile()->GetFilename() + ".patches"))
+    {
+        RunBackgroundTask("Exporting Patches", view, [path] (BinaryView& view)
+        {
+            PatchBuilder::ExportPatches(view, path);
+        });
+    }
+}
+
+void ImportPatchesTask(BinaryView* view)
+{
+    std::string path;
+
+    if (GetOpenFileNameInput(path, "Import Patches", "*.patches"))
+    {
+        RunBackgroundTask("Importing Patches", view, [path] (BinaryView& view)
+        {
+            PatchBuilder::ImportPatches(view, path);
+        });
+    }
+}
+
+void BenchmarkCodecsTask(BinaryView* view)
+{
+    RunBackgroundTask("Benchmarking Patch Codecs", view, [ ] (BinaryView& view)
+    {
+        PatchBuilder::BenchmarkCodecs(view);
+    });
+}
+
+void BenchmarkLiftingTask(BinaryView* view)
+{
+    RunBackgroundTask("Benchmarking Patch Lifting", view, [ ] (BinaryView& view)
+    {
+        PatchBuilder::BenchmarkLifting(view);
+    });
+}
+
+void BenchmarkDataStoreTask(BinaryView* view)
+{
+    RunBackgroundTask("Benchmarking Associated Data Store", view, [ ] (BinaryView& view)
+    {
+        (void)view;
+
+        BenchmarkAssociatedDataStore();
+    });
+}
+
 extern "C"
 {
     BINARYNINJAPLUGIN bool CorePluginInit()
@@ -58,10 +218,34 @@ extern "C"
             RegisterObfuHook(arch);
         }
 
+        RegisterObfuPasses();
+
+        BinaryViewType::RegisterBinaryViewFinalizationEvent([ ] (BinaryView* view)
+        {
+            PatchBuilder::PreloadPatches(*view);
+        });
+
+        // Registered after every static in the plugin is constructed, so this runs before any of them are destroyed,
+        // whether the process is exiting or just the plugin is being unloaded
+        std::atexit(&PatchBuilder::ShutdownPatches);
+
         PluginCommand::RegisterForFunction("Obfuscation\\Fix Obfuscation Background", "", &FixObfuscationBackgroundTask);
         PluginCommand::RegisterForFunction("Obfuscation\\Fix Obfuscation", "", &FixObfuscationTask);
+        PluginCommand::Register("Obfuscation\\Fix Obfuscation All Functions", "", &FixObfuscationAllTask);
+        PluginCommand::RegisterForRange("Obfuscation\\Fix Obfuscation Selected Functions", "", &FixObfuscationSelectedTask);
         PluginCommand::Register("Obfuscation\\Load Patches", "", &LoadPatchesTask);
         PluginCommand::Register("Obfuscation\\Save Patches", "", &SavePatchesTask);
+        PluginCommand::Register("Obfuscation\\Export Patches", "", &ExportPatchesTask);
+        PluginCommand::Register("Obfuscation\\Import Patches", "", &ImportPatchesTask);
+        PluginCommand::Register("Obfuscation\\Benchmark Patch Codecs", "", &BenchmarkCodecsTask);
+        PluginCommand::Register("Obfuscation\\Benchmark Patch Lifting", "", &BenchmarkLiftingTask);
+        PluginCommand::Register("Obfuscation\\Benchmark Associated Data Store", "", &BenchmarkDataStoreTask);
+        PluginCommand::Register("Obfuscation\\Log Pass Statistics", "", &LogPassStatisticsTask);
+        PluginCommand::Register("Obfuscation\\Reset Pass Statistics", "", &ResetPassStatisticsTask);
+        PluginCommand::Register("Obfuscation\\Start Trace", "", &StartTraceTask);
+        PluginCommand::Register("Obfuscation\\Stop Trace", "", &StopTraceTask);
+        PluginCommand::Register("Obfuscation\\Log Hook Statistics", "", &LogHookStatisticsTask);
+        PluginCommand::Register("Obfuscation\\Reset Hook Statistics", "", &ResetHookStatisticsTask);
 
         BinjaLog(InfoLog, "Loaded binja-obfu");
 